@@ -0,0 +1,478 @@
+#include "pch.h"
+#include "batch.h"
+#include "config.h"
+#include "song.h"
+#include "midi.h"
+#include "export_wav.h"
+#include "export_trace.h"
+#include "output_asio.h"
+#include "output_dsound.h"
+#include "output_wasapi.h"
+#include "synthesizer_vst.h"
+
+#include <Shlwapi.h>
+#include <shellapi.h>
+#include <string>
+#include <vector>
+
+#define BATCH_MAX_JOBS    MAXIMUM_WAIT_OBJECTS
+
+// command line arguments
+static std::vector<std::string> batch_args;
+
+// options passed on to conversion jobs
+static std::string batch_job_args;
+
+// trace options, golden is a directory when converting a batch
+static std::string batch_golden;
+static uint batch_block_size = 64;
+static uint batch_sample_rate = 44100;
+
+// conversion job
+struct batch_job_t {
+  std::string input;
+  std::string output;
+  HANDLE process;
+  DWORD start_time;
+};
+
+// parse command line into ansi arguments
+static void batch_parse_args() {
+  if (!batch_args.empty())
+    return;
+
+  int argc = 0;
+  LPWSTR *argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  if (!argv)
+    return;
+
+  for (int i = 0; i < argc; i++) {
+    char buff[MAX_PATH * 2];
+    WideCharToMultiByte(CP_ACP, 0, argv[i], -1, buff, sizeof(buff), NULL, NULL);
+    batch_args.push_back(buff);
+  }
+
+  LocalFree(argv);
+}
+
+// print usage
+static void batch_usage() {
+  puts("usage:");
+  puts("  freepiano -batch <fpm|mid|wav|fpt> <input file or directory> <output directory> [-jobs n]");
+  puts("  freepiano -convert <fpm|mid|wav|fpt> <input file> <output file>");
+  puts("  freepiano -playlist <song, directory or list file> [-repeat]");
+  puts("transform options:");
+  puts("  -quantize <ms> [-strength <percent>] -humanize <ms> -humanize-velocity <n>");
+  puts("  -velocity-curve <exponent> -thin <ms>");
+  puts("trace options (fpt):");
+  puts("  -golden <trace file, or directory for -batch> -block <samples> -rate <hz>");
+}
+
+// parse transform options, returns true when any transform is requested
+static bool batch_parse_transform(song_transform_t &transform) {
+  bool enabled = false;
+
+  transform.grid = 0;
+  transform.strength = 100;
+  transform.humanize = 0;
+  transform.humanize_velocity = 0;
+  transform.velocity_curve = 1;
+  transform.thin = 0;
+
+  for (size_t i = 5; i + 1 < batch_args.size(); i++) {
+    const std::string &name = batch_args[i];
+    const char *value = batch_args[i + 1].c_str();
+
+    if (name == "-quantize")                transform.grid = atoi(value);
+    else if (name == "-strength")           transform.strength = atoi(value);
+    else if (name == "-humanize")           transform.humanize = atoi(value);
+    else if (name == "-humanize-velocity")  transform.humanize_velocity = atoi(value);
+    else if (name == "-velocity-curve")     transform.velocity_curve = atof(value);
+    else if (name == "-thin")               transform.thin = atoi(value);
+    else continue;
+
+    batch_job_args += " " + name + " " + value;
+    enabled = true;
+    i++;
+  }
+
+  return enabled;
+}
+
+// parse trace options
+static void batch_parse_trace() {
+  for (size_t i = 5; i + 1 < batch_args.size(); i++) {
+    const std::string &name = batch_args[i];
+    const char *value = batch_args[i + 1].c_str();
+
+    if (name == "-golden")      batch_golden = value;
+    else if (name == "-block")  batch_block_size = atoi(value);
+    else if (name == "-rate")   batch_sample_rate = atoi(value);
+    else continue;
+
+    // golden trace of each song is passed on by batch_start_job
+    if (name != "-golden")
+      batch_job_args += " " + name + " " + value;
+    i++;
+  }
+}
+
+// check output format
+static bool batch_valid_format(const char *format) {
+  return strcmp(format, "fpm") == 0 ||
+         strcmp(format, "mid") == 0 ||
+         strcmp(format, "wav") == 0 ||
+         strcmp(format, "fpt") == 0;
+}
+
+// check input extension
+static bool batch_valid_input(const char *filename) {
+  const char *extension = PathFindExtension(filename);
+
+  return _stricmp(extension, ".fpm") == 0 ||
+         _stricmp(extension, ".lyt") == 0 ||
+         _stricmp(extension, ".mid") == 0 ||
+         _stricmp(extension, ".midi") == 0;
+}
+
+// open song by extension
+static int batch_open_song(const char *filename) {
+  const char *extension = PathFindExtension(filename);
+
+  if (_stricmp(extension, ".lyt") == 0)
+    return song_open_lyt(filename);
+
+  if (_stricmp(extension, ".mid") == 0 || _stricmp(extension, ".midi") == 0)
+    return song_open_midi(filename);
+
+  return song_open(filename);
+}
+
+// convert a single song in this process
+static int batch_convert(const char *format, const char *input, const char *output) {
+  char line[1024];
+  DWORD start_time = GetTickCount();
+
+  // instrument and volume come from the default config, audio output stays closed
+  config_init();
+  config_load("freepiano.cfg");
+  midi_close_inputs();
+  asio_close();
+  dsound_close();
+  wasapi_close();
+
+  int result = batch_open_song(input);
+
+  song_transform_t transform;
+  if (result == 0 && batch_parse_transform(transform))
+    result = song_transform(transform);
+
+  batch_parse_trace();
+  line[0] = 0;
+
+  if (result == 0) {
+    if (strcmp(format, "fpt") == 0) {
+      export_trace_result_t trace;
+      const char *golden = batch_golden.empty() ? NULL : batch_golden.c_str();
+
+      result = export_trace(output, golden, batch_block_size, batch_sample_rate, &trace);
+
+      if (result == 0) {
+        int length = _snprintf(line, sizeof(line), "%s -> %s: %u events in %.3fs (%.0f events/s)",
+                               input, output, trace.events, trace.seconds,
+                               trace.seconds > 0 ? trace.events / trace.seconds : 0);
+
+        if (golden && trace.mismatch >= 0) {
+          _snprintf(line + length, sizeof(line) - length, ", differs from golden trace at event %d\n", trace.mismatch);
+          result = 1;
+        } else {
+          _snprintf(line + length, sizeof(line) - length, golden ? ", matches golden trace\n" : "\n");
+        }
+      }
+    } else if (strcmp(format, "fpm") == 0) {
+      result = song_save(output);
+    } else if (strcmp(format, "mid") == 0) {
+      result = song_save_midi(output);
+    } else if (strcmp(format, "wav") == 0) {
+      if (vsti_is_instrument_loaded()) {
+        result = export_wav_offline(output);
+      } else {
+        _snprintf(line, sizeof(line), "%s: no vst instrument selected\n", input);
+        result = -1;
+      }
+    }
+  }
+
+  // a conversion may have written its own report
+  if (line[0] == 0) {
+    if (result == 0) {
+      double song_time = song_get_length() / 1000.0;
+      double elapsed = (GetTickCount() - start_time) / 1000.0;
+      double speed = elapsed > 0 ? song_time / elapsed : 0;
+
+      _snprintf(line, sizeof(line), "%s -> %s: %.1fs of song in %.2fs (%.1fx)\n",
+                input, output, song_time, elapsed, speed);
+    } else {
+      _snprintf(line, sizeof(line), "%s: conversion failed\n", input);
+    }
+  }
+
+  // one write per line, so lines from concurrent jobs do not interleave
+  fputs(line, stdout);
+  fflush(stdout);
+
+  song_close();
+  config_shutdown();
+  return result == 0 ? 0 : 1;
+}
+
+// start a child process converting one song
+static bool batch_start_job(batch_job_t &job, const char *format) {
+  char module[MAX_PATH];
+  GetModuleFileNameA(NULL, module, sizeof(module));
+
+  std::string command;
+  command += "\"";
+  command += module;
+  command += "\" -convert ";
+  command += format;
+  command += " \"";
+  command += job.input;
+  command += "\" \"";
+  command += job.output;
+  command += "\"";
+  command += batch_job_args;
+
+  if (!batch_golden.empty()) {
+    char golden[MAX_PATH];
+    PathCombine(golden, batch_golden.c_str(), PathFindFileName(job.output.c_str()));
+    command += " -golden \"";
+    command += golden;
+    command += "\"";
+  }
+
+  std::vector<char> buff(command.begin(), command.end());
+  buff.push_back(0);
+
+  STARTUPINFO si;
+  PROCESS_INFORMATION pi;
+  memset(&si, 0, sizeof(si));
+  si.cb = sizeof(si);
+
+  if (!CreateProcess(NULL, &buff[0], NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+    return false;
+
+  CloseHandle(pi.hThread);
+  job.process = pi.hProcess;
+  job.start_time = GetTickCount();
+  return true;
+}
+
+// list songs in a directory or a single song
+static void batch_list_inputs(const char *input, std::vector<std::string> &files) {
+  if (PathIsDirectory(input)) {
+    char pattern[MAX_PATH];
+    PathCombine(pattern, input, "*");
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+
+    if (find != INVALID_HANDLE_VALUE) {
+      do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && batch_valid_input(data.cFileName)) {
+          char path[MAX_PATH];
+          PathCombine(path, input, data.cFileName);
+          files.push_back(path);
+        }
+      } while (FindNextFileA(find, &data));
+
+      FindClose(find);
+    }
+  } else if (batch_valid_input(input)) {
+    files.push_back(input);
+  }
+}
+
+// collect input files
+static void batch_collect_inputs(const char *input, const char *output_dir, const char *format, std::vector<batch_job_t> &jobs) {
+  std::vector<std::string> files;
+  batch_list_inputs(input, files);
+
+  for (size_t i = 0; i < files.size(); i++) {
+    char name[MAX_PATH];
+    char path[MAX_PATH];
+
+    strncpy(name, PathFindFileName(files[i].c_str()), sizeof(name) - 5);
+    name[sizeof(name) - 5] = 0;
+    PathRemoveExtension(name);
+    strcat(name, ".");
+    strcat(name, format);
+    PathCombine(path, output_dir, name);
+
+    batch_job_t job;
+    job.input = files[i];
+    job.output = path;
+    job.process = NULL;
+    job.start_time = 0;
+    jobs.push_back(job);
+  }
+}
+
+// convert all songs using a pool of processes, one song per process
+static int batch_run(const char *format, const char *input, const char *output_dir, int max_jobs) {
+  std::vector<batch_job_t> jobs;
+  batch_collect_inputs(input, output_dir, format, jobs);
+
+  if (jobs.empty()) {
+    puts("no input songs found");
+    return 1;
+  }
+
+  CreateDirectory(output_dir, NULL);
+
+  DWORD start_time = GetTickCount();
+  size_t next = 0;
+  int failed = 0;
+
+  std::vector<HANDLE> handles;
+  std::vector<size_t> running;
+
+  while (next < jobs.size() || !running.empty()) {
+    // fill pool
+    while (next < jobs.size() && (int)running.size() < max_jobs) {
+      if (batch_start_job(jobs[next], format)) {
+        handles.push_back(jobs[next].process);
+        running.push_back(next);
+      } else {
+        printf("%s: failed to start conversion\n", jobs[next].input.c_str());
+        failed++;
+      }
+      next++;
+    }
+
+    if (running.empty())
+      break;
+
+    // wait for any job
+    DWORD index = WaitForMultipleObjects(handles.size(), &handles[0], FALSE, INFINITE) - WAIT_OBJECT_0;
+    if (index >= handles.size())
+      break;
+
+    DWORD exit_code = 1;
+    GetExitCodeProcess(handles[index], &exit_code);
+    CloseHandle(handles[index]);
+
+    if (exit_code != 0)
+      failed++;
+
+    handles.erase(handles.begin() + index);
+    running.erase(running.begin() + index);
+  }
+
+  double elapsed = (GetTickCount() - start_time) / 1000.0;
+  printf("%d songs converted, %d failed, %.2fs elapsed, %.2f songs/s using %d jobs\n",
+         (int)jobs.size() - failed, failed, elapsed,
+         elapsed > 0 ? jobs.size() / elapsed : 0, max_jobs);
+
+  return failed ? 1 : 0;
+}
+
+// check command line for batch mode
+bool batch_requested() {
+  batch_parse_args();
+
+  return batch_args.size() > 1 &&
+         (batch_args[1] == "-batch" || batch_args[1] == "-convert");
+}
+
+// start playlist from command line, songs come from a directory, a list file with one
+// song per line, or a single song
+bool batch_start_playlist() {
+  batch_parse_args();
+
+  if (batch_args.size() < 3 || batch_args[1] != "-playlist")
+    return false;
+
+  const char *input = batch_args[2].c_str();
+  const char *extension = PathFindExtension(input);
+  std::vector<std::string> files;
+
+  if (_stricmp(extension, ".m3u") == 0 || _stricmp(extension, ".txt") == 0) {
+    FILE *fp = fopen(input, "r");
+
+    if (fp) {
+      char line[MAX_PATH];
+      char base[MAX_PATH];
+      char path[MAX_PATH];
+
+      strncpy(base, input, sizeof(base));
+      base[sizeof(base) - 1] = 0;
+      PathRemoveFileSpec(base);
+
+      while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = 0;
+
+        if (line[0] == 0 || line[0] == '#')
+          continue;
+
+        PathCombine(path, base, line);
+        files.push_back(path);
+      }
+
+      fclose(fp);
+    }
+  } else {
+    batch_list_inputs(input, files);
+  }
+
+  song_playlist_clear();
+
+  for (size_t i = 0; i < files.size(); i++)
+    song_playlist_add(files[i].c_str());
+
+  song_playlist_set_repeat(batch_args.size() > 3 && batch_args[3] == "-repeat");
+
+  return song_playlist_play() == 0;
+}
+
+// run batch mode
+int batch_main() {
+  batch_parse_args();
+
+  // write to the console we were started from
+  if (AttachConsole(ATTACH_PARENT_PROCESS)) {
+    freopen("CONOUT$", "w", stdout);
+    freopen("CONOUT$", "w", stderr);
+  }
+
+  if (batch_args.size() < 5 || !batch_valid_format(batch_args[2].c_str())) {
+    batch_usage();
+    return 1;
+  }
+
+  const char *format = batch_args[2].c_str();
+  const char *input = batch_args[3].c_str();
+  const char *output = batch_args[4].c_str();
+
+  if (batch_args[1] == "-convert")
+    return batch_convert(format, input, output);
+
+  // one song per core by default
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int jobs = info.dwNumberOfProcessors;
+
+  for (size_t i = 5; i + 1 < batch_args.size(); i++) {
+    if (batch_args[i] == "-jobs")
+      jobs = atoi(batch_args[i + 1].c_str());
+  }
+
+  if (jobs < 1) jobs = 1;
+  if (jobs > BATCH_MAX_JOBS) jobs = BATCH_MAX_JOBS;
+
+  song_transform_t transform;
+  batch_parse_transform(transform);
+  batch_parse_trace();
+
+  return batch_run(format, input, output, jobs);
+}
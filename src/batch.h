@@ -0,0 +1,10 @@
+#pragma once
+
+// check command line for batch mode
+bool batch_requested();
+
+// run batch conversion from command line
+int batch_main();
+
+// start playlist from command line
+bool batch_start_playlist();
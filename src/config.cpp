@@ -19,6 +19,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 // -----------------------------------------------------------------------------------------
 // config defines
@@ -600,6 +601,7 @@ struct global_setting_t {
   uint midi_transpose;
   uint fixed_doh;
   uint key_fade;
+  uint record_thin;
   byte gui_transparency;
   byte auto_color;
   byte preview_color;
@@ -632,17 +634,97 @@ struct global_setting_t {
     update_version = 0;
 
     key_fade = 0;
+    record_thin = 0;
   }
 };
 
-struct setting_t {
-  // keymap
+// reference counted table shared by setting groups, copied on first write
+template<typename T>
+struct setting_shared_t {
+  struct block_t {
+    volatile long refcount;
+    T data;
+  };
+
+  block_t *block;
+  static const T empty;
+
+  setting_shared_t() : block(NULL) {}
+  setting_shared_t(const setting_shared_t &other) : block(other.block) { acquire(); }
+  ~setting_shared_t() { release(); }
+
+  setting_shared_t& operator = (const setting_shared_t &other) {
+    if (block != other.block) {
+      release();
+      block = other.block;
+      acquire();
+    }
+    return *this;
+  }
+
+  // table for reading, groups without own table share the default one
+  const T& get() const {
+    return block ? block->data : empty;
+  }
+
+  // table for writing
+  T& edit() {
+    if (block == NULL) {
+      block = new block_t;
+      block->refcount = 1;
+    }
+    else if (block->refcount > 1) {
+      block_t *copy = new block_t;
+      copy->refcount = 1;
+      copy->data = block->data;
+      release();
+      block = copy;
+    }
+    return block->data;
+  }
+
+  // back to default table
+  void reset() {
+    release();
+    block = NULL;
+  }
+
+  void acquire() {
+    if (block)
+      InterlockedIncrement(&block->refcount);
+  }
+
+  void release() {
+    if (block && InterlockedDecrement(&block->refcount) == 0)
+      delete block;
+  }
+};
+
+template<typename T>
+const T setting_shared_t<T>::empty;
+
+struct setting_keymap_t {
   std::multimap<byte, key_bind_t> keydown_map;
   std::multimap<byte, key_bind_t> keyup_map;
 
-  // key label
+  setting_keymap_t() {}
+};
+
+struct setting_labels_t {
   key_label_t key_label[256];
 
+  setting_labels_t() {
+    memset(key_label, 0, sizeof(key_label));
+  }
+};
+
+struct setting_t {
+  // keymap
+  setting_shared_t<setting_keymap_t> keymap;
+
+  // key label
+  setting_shared_t<setting_labels_t> labels;
+
   // key properties
   char key_octshift[16];
   char key_transpose[16];
@@ -650,19 +732,21 @@ struct setting_t {
   char key_channel[16];
   char key_signature;
   char follow_key[16];
+
+  // midi state, written in place by lock-free writers
   char midi_program[16];
   char midi_controller[16][256];
 
+  setting_t() {
+    clear();
+  }
+
   void clear() {
     key_signature = 0;
 
-    keydown_map.clear();
-    keyup_map.clear();
-
-    for (int i = 0; i < 256; i++) {
-      memset(key_label[i].text, 0, sizeof(key_label[i].text));
-      key_label[i].color = 0;
-    }
+    keymap.reset();
+    labels.reset();
+    memset(midi_controller, -1, sizeof(midi_controller));
 
     for (int i = 0; i < 16; i++) {
       key_octshift[i] = 0;
@@ -672,35 +756,244 @@ struct setting_t {
       follow_key[i] = 1;
 
       midi_program[i] = -1;
-
-      for (int j = 0; j < 128; j++)
-        midi_controller[i][j] = -1;
     }
   }
 };
 
 // settings
 static global_setting_t global;
-static setting_t settings[256];
+static setting_t *settings[256] = {0};
 static uint current_setting = 0;
-static uint setting_count = 1;
+static uint setting_count = 0;
 
 // song thread lock
 static thread_lock_t config_lock;
 
+// compiled key bind tables of each group, and the one of current group
+static key_bind_table_t *bind_tables[256] = {0};
+static key_bind_table_t *volatile bind_current = NULL;
+
+// key binds of a group changed since its table was compiled
+static bool bind_dirty[256] = {0};
+static volatile bool bind_pending = false;
+
+// setting values of current group, published snapshots are never modified
+struct setting_values_t {
+  long epoch;                 // epoch the snapshot was retired at
+  setting_t *group;           // midi programs and controllers live in the group
+
+  char key_signature;
+  char key_octshift[16];
+  char key_transpose[16];
+  char key_velocity[16];
+  char key_channel[16];
+  char follow_key[16];
+
+  key_translate_t translate;  // note translation tables
+};
+
+// preallocated snapshots, reused once retired long enough
+static setting_values_t setting_values_ring[16];
+static setting_values_t *volatile setting_values = NULL;
+
+// published values are older than current group
+static bool config_values_dirty = false;
+
+// published data replaced by writers, freed when no reader can hold it
+struct config_retired_t {
+  void *data;
+  void (*release)(void *data);
+  long epoch;
+};
+static std::vector<config_retired_t> config_retired;
+
+// read epoch, readers count themselves in the counter of current epoch parity
+static volatile long config_epoch = 2;
+static volatile long config_readers[2] = {0, 0};
+
 // verison
 static uint map_language = FP_LANG_ENGLISH;
 static uint map_version = 0;
 static const uint map_current_version = APP_VERSION;
 
 
+// -----------------------------------------------------------------------------------------
+// published config data
+// -----------------------------------------------------------------------------------------
+// lock-free readers only see data published by a pointer swap. writers retire the
+// replaced data with the current epoch. the epoch only advances when the readers
+// counted in the other parity are gone, so once it advanced twice no reader can
+// still hold the retired data.
+
+// enter read section
+config_read_t::config_read_t() {
+  for (;;) {
+    slot = config_epoch & 1;
+    InterlockedIncrement(&config_readers[slot]);
+
+    // epoch changed before we were counted, count again in the new parity
+    if ((config_epoch & 1) == slot)
+      break;
+
+    InterlockedDecrement(&config_readers[slot]);
+  }
+}
+
+// leave read section
+config_read_t::~config_read_t() {
+  InterlockedDecrement(&config_readers[slot]);
+}
+
+// advance epoch when readers of the previous epoch are gone
+static void config_epoch_advance() {
+  long epoch = config_epoch;
+
+  if (config_readers[(epoch + 1) & 1] == 0)
+    InterlockedCompareExchange(&config_epoch, epoch + 1, epoch);
+}
+
+// data retired at epoch can be reused
+static bool config_epoch_passed(long epoch) {
+  if (config_epoch - epoch < 2)
+    config_epoch_advance();
+
+  return config_epoch - epoch >= 2;
+}
+
+// free retired data nobody can be reading
+static void config_reclaim() {
+  thread_lock lock(config_lock);
+
+  for (uint i = 0; i < config_retired.size();) {
+    if (config_epoch_passed(config_retired[i].epoch)) {
+      config_retired[i].release(config_retired[i].data);
+      config_retired[i] = config_retired.back();
+      config_retired.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+// retire unpublished data
+static void config_retire(void *data, void (*release)(void *data)) {
+  thread_lock lock(config_lock);
+
+  if (data) {
+    config_retired_t retired = { data, release, config_epoch };
+    config_retired.push_back(retired);
+  }
+
+  config_reclaim();
+}
+
+// -----------------------------------------------------------------------------------------
+// key binds
+// -----------------------------------------------------------------------------------------
+// free a key bind table
+static void config_bind_release(void *table) {
+  free(table);
+}
+
+// compile key binds of a setting group
+static key_bind_table_t* config_bind_compile(const setting_t &setting) {
+  const setting_keymap_t &keymap = setting.keymap.get();
+  uint count = keymap.keydown_map.size() + keymap.keyup_map.size();
+  key_bind_table_t *table = (key_bind_table_t*)malloc(sizeof(key_bind_table_t) + count * sizeof(key_bind_t));
+  uint pos = 0;
+
+  if (table == NULL)
+    return NULL;
+
+  // multimap is ordered by key code, so binds of each key are already grouped
+  auto it = keymap.keydown_map.begin();
+  for (uint code = 0; code < 256; code++) {
+    table->keydown[code] = pos;
+    for (; it != keymap.keydown_map.end() && it->first == code; ++it)
+      table->binds[pos++] = it->second;
+  }
+  table->keydown[256] = pos;
+
+  it = keymap.keyup_map.begin();
+  for (uint code = 0; code < 256; code++) {
+    table->keyup[code] = pos;
+    for (; it != keymap.keyup_map.end() && it->first == code; ++it)
+      table->binds[pos++] = it->second;
+  }
+  table->keyup[256] = pos;
+
+  return table;
+}
+
+// publish key bind table of current group, none while it is out of date
+static void config_bind_publish() {
+  thread_lock lock(config_lock);
+
+  key_bind_table_t *table = bind_dirty[current_setting] ? NULL : bind_tables[current_setting];
+  InterlockedExchangePointer((void* volatile*)&bind_current, table);
+}
+
+// mark key binds of a group changed, they are compiled by config_bind_update so a
+// batch of changes compiles the table once
+static void config_bind_changed(uint group) {
+  thread_lock lock(config_lock);
+
+  if (group >= setting_count)
+    return;
+
+  bind_dirty[group] = true;
+  bind_pending = true;
+
+  if (group == current_setting)
+    config_bind_publish();
+}
+
+// compile key binds of changed groups
+void config_bind_update() {
+  thread_lock lock(config_lock);
+
+  bind_pending = false;
+
+  for (uint group = 0; group < setting_count; group++) {
+    if (!bind_dirty[group])
+      continue;
+
+    key_bind_table_t *table = config_bind_compile(*settings[group]);
+
+    // out of memory, binds are still looked up in the key map
+    if (table == NULL) {
+      bind_pending = true;
+      continue;
+    }
+
+    key_bind_table_t *old = bind_tables[group];
+    table->version = old ? old->version + 1 : 1;
+    bind_tables[group] = table;
+    bind_dirty[group] = false;
+
+    config_retire(old, config_bind_release);
+  }
+
+  config_bind_publish();
+}
+
+// key binds wait for config_bind_update
+bool config_bind_deferred() {
+  return bind_pending;
+}
+
+// get compiled key binds of current setting group
+const key_bind_table_t* config_bind_get_table() {
+  return bind_current;
+}
+
 int config_bind_get_keydown(byte code, key_bind_t *buff, int size) {
   thread_lock lock(config_lock);
 
   int result = 0;
   if (buff) {
-    auto it = settings[current_setting].keydown_map.find(code);
-    auto end = settings[current_setting].keydown_map.end();
+    auto it = settings[current_setting]->keymap.get().keydown_map.find(code);
+    auto end = settings[current_setting]->keymap.get().keydown_map.end();
 
     while (it != end && it->first == code) {
       if (result < size) {
@@ -718,8 +1011,8 @@ int config_bind_get_keyup(byte code, key_bind_t *buff, int size) {
 
   int result = 0;
   if (buff) {
-    auto it = settings[current_setting].keyup_map.find(code);
-    auto end = settings[current_setting].keyup_map.end();
+    auto it = settings[current_setting]->keymap.get().keyup_map.find(code);
+    auto end = settings[current_setting]->keymap.get().keyup_map.end();
 
     while (it != end && it->first == code) {
       if (result < size) {
@@ -735,20 +1028,23 @@ int config_bind_get_keyup(byte code, key_bind_t *buff, int size) {
 void config_bind_clear_keydown(byte code) {
   thread_lock lock(config_lock);
 
-  settings[current_setting].keydown_map.erase(code);
+  settings[current_setting]->keymap.edit().keydown_map.erase(code);
+  config_bind_changed(current_setting);
 }
 
 void config_bind_clear_keyup(byte code) {
   thread_lock lock(config_lock);
 
-  settings[current_setting].keyup_map.erase(code);
+  settings[current_setting]->keymap.edit().keyup_map.erase(code);
+  config_bind_changed(current_setting);
 }
 
 void config_bind_add_keydown(byte code, key_bind_t bind) {
   thread_lock lock(config_lock);
 
   if (bind.a) {
-    settings[current_setting].keydown_map.insert(std::pair<byte, key_bind_t>(code, bind));
+    settings[current_setting]->keymap.edit().keydown_map.insert(std::pair<byte, key_bind_t>(code, bind));
+    config_bind_changed(current_setting);
   }
 }
 
@@ -756,62 +1052,162 @@ void config_bind_add_keyup(byte code, key_bind_t bind) {
   thread_lock lock(config_lock);
 
   if (bind.a) {
-    settings[current_setting].keyup_map.insert(std::pair<byte, key_bind_t>(code, bind));
+    settings[current_setting]->keymap.edit().keyup_map.insert(std::pair<byte, key_bind_t>(code, bind));
+    config_bind_changed(current_setting);
   }
 }
 
 void config_bind_set_label(byte code, const char *label) {
   thread_lock lock(config_lock);
 
-  strncpy(settings[current_setting].key_label[code].text, label ? label : "", sizeof(settings[current_setting].key_label[code].text));
+  key_label_t &key_label = settings[current_setting]->labels.edit().key_label[code];
+  strncpy(key_label.text, label ? label : "", sizeof(key_label.text));
 }
 
-const char* config_bind_get_label(byte code) {
+// get bind label, copied while the group can not change
+void config_bind_get_label(byte code, char *buff, int size) {
   thread_lock lock(config_lock);
 
-  return settings[current_setting].key_label[code].text;
+  const key_label_t &key_label = settings[current_setting]->labels.get().key_label[code];
+
+  if (buff && size > 0) {
+    int length = strnlen(key_label.text, sizeof(key_label.text));
+    if (length > size - 1)
+      length = size - 1;
+
+    memcpy(buff, key_label.text, length);
+    buff[length] = 0;
+  }
 }
 
 // set bind color
 void config_bind_set_color(byte code, uint color) {
   thread_lock lock(config_lock);
-  settings[current_setting].key_label[code].color = color;
+  settings[current_setting]->labels.edit().key_label[code].color = color;
 }
 
 // get bind color
 uint config_bind_get_color(byte code) {
-  return settings[current_setting].key_label[code].color;
+  thread_lock lock(config_lock);
+
+  return settings[current_setting]->labels.get().key_label[code].color;
+}
+
+// find a snapshot no reader can hold, returns NULL when all are still in use
+static setting_values_t* config_values_acquire() {
+  static uint next = 0;
+
+  for (uint i = 0; i < ARRAY_COUNT(setting_values_ring); i++) {
+    setting_values_t *slot = &setting_values_ring[(next + i) % ARRAY_COUNT(setting_values_ring)];
+
+    if (slot != setting_values && config_epoch_passed(slot->epoch)) {
+      next = (next + i + 1) % ARRAY_COUNT(setting_values_ring);
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+// fill a snapshot from current group and publish it
+static void config_values_store(setting_values_t *values) {
+  const setting_t &setting = *settings[current_setting];
+
+  values->group = settings[current_setting];
+  values->key_signature = setting.key_signature;
+  memcpy(values->key_octshift, setting.key_octshift, sizeof(values->key_octshift));
+  memcpy(values->key_transpose, setting.key_transpose, sizeof(values->key_transpose));
+  memcpy(values->key_velocity, setting.key_velocity, sizeof(values->key_velocity));
+  memcpy(values->key_channel, setting.key_channel, sizeof(values->key_channel));
+  memcpy(values->follow_key, setting.follow_key, sizeof(values->follow_key));
+
+  // note translation tables
+  key_translate_t &lut = values->translate;
+  lut.key_signature = setting.key_signature;
+
+  for (int ch = 0; ch < 16; ch++) {
+    int shift = setting.key_octshift[ch] * 12 + setting.key_transpose[ch];
+    int signature = setting.follow_key[ch] ? setting.key_signature : 0;
+    int velocity = (byte)setting.key_velocity[ch];
+
+    lut.shift[ch] = shift;
+    lut.key_velocity[ch] = velocity;
+    lut.follow_key[ch] = setting.follow_key[ch];
+
+    for (int i = 0; i < 128; i++) {
+      lut.note[ch][i] = clamp_value(i + shift + signature, 0, 127);
+      lut.velocity[ch][i] = clamp_value(i * velocity / 127, 0, 127);
+    }
+  }
+
+  setting_values_t *old = (setting_values_t*)InterlockedExchangePointer((void* volatile*)&setting_values, values);
+
+  if (old)
+    old->epoch = config_epoch;
+
+  config_values_dirty = false;
+}
+
+// publish setting values of current group. this never waits for readers, when all
+// snapshots are still held the values are published later by config_values_update.
+static void config_values_publish() {
+  thread_lock lock(config_lock);
+
+  if (setting_values_t *values = config_values_acquire())
+    config_values_store(values);
+  else
+    config_values_dirty = true;
+}
+
+// publish setting values when an earlier publish was deferred
+void config_values_update() {
+  thread_lock lock(config_lock);
+
+  if (config_values_dirty)
+    config_values_publish();
+}
+
+// published values are older than current group
+bool config_values_deferred() {
+  return config_values_dirty;
+}
+
+// get note translation tables of current group, call inside a read section
+const key_translate_t* config_get_key_translate() {
+  return &setting_values->translate;
 }
 
 // set key signature
 void config_set_key_signature(char key) {
   thread_lock lock(config_lock);
 
-  settings[current_setting].key_signature = key;
+  settings[current_setting]->key_signature = key;
+  config_values_publish();
 }
 
 // get key signature
 char config_get_key_signature() {
-  thread_lock lock(config_lock);
-
-  return settings[current_setting].key_signature;
+  config_read_t read;
+  return setting_values->key_signature;
 }
 
 // set transpose
 void config_set_key_transpose(byte channel, char transpose) {
   thread_lock lock(config_lock);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_transpose)) {
-    settings[current_setting].key_transpose[channel] = transpose;
+  if (channel < ARRAY_COUNT(settings[current_setting]->key_transpose)) {
+    settings[current_setting]->key_transpose[channel] = transpose;
+    config_values_publish();
   }
 }
 
 // get transpose
 char config_get_key_transpose(byte channel) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_transpose))
-    return settings[current_setting].key_transpose[channel];
+  if (channel < ARRAY_COUNT(values.key_transpose))
+    return values.key_transpose[channel];
   else
     return 0;
 }
@@ -820,17 +1216,19 @@ char config_get_key_transpose(byte channel) {
 void config_set_key_octshift(byte channel, char shift) {
   thread_lock lock(config_lock);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_octshift)) {
-    settings[current_setting].key_octshift[channel] = shift;
+  if (channel < ARRAY_COUNT(settings[current_setting]->key_octshift)) {
+    settings[current_setting]->key_octshift[channel] = shift;
+    config_values_publish();
   }
 }
 
 // get octave shift
 char config_get_key_octshift(byte channel) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_octshift))
-    return settings[current_setting].key_octshift[channel];
+  if (channel < ARRAY_COUNT(values.key_octshift))
+    return values.key_octshift[channel];
   else
     return 0;
 }
@@ -839,17 +1237,19 @@ char config_get_key_octshift(byte channel) {
 void config_set_key_velocity(byte channel, byte velocity) {
   thread_lock lock(config_lock);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_velocity)) {
-    settings[current_setting].key_velocity[channel] = velocity;
+  if (channel < ARRAY_COUNT(settings[current_setting]->key_velocity)) {
+    settings[current_setting]->key_velocity[channel] = velocity;
+    config_values_publish();
   }
 }
 
 // get velocity
 byte config_get_key_velocity(byte channel) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_velocity))
-    return settings[current_setting].key_velocity[channel];
+  if (channel < ARRAY_COUNT(values.key_velocity))
+    return values.key_velocity[channel];
   else
     return 127;
 }
@@ -858,82 +1258,93 @@ byte config_get_key_velocity(byte channel) {
 void config_set_follow_key(byte channel, byte value) {
   thread_lock lock(config_lock);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].follow_key)) {
-    settings[current_setting].follow_key[channel] = value;
+  if (channel < ARRAY_COUNT(settings[current_setting]->follow_key)) {
+    settings[current_setting]->follow_key[channel] = value;
+    config_values_publish();
   }
 }
 
 // get follow key
 byte config_get_follow_key(byte channel) {
-  if (channel < ARRAY_COUNT(settings[current_setting].follow_key))
-    return settings[current_setting].follow_key[channel];
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
+
+  if (channel < ARRAY_COUNT(values.follow_key))
+    return values.follow_key[channel];
   else
     return 0;
 }
 
-// get channel
-int config_get_output_channel(byte channel) {
-  thread_lock lock(config_lock);
-
+// output channel in setting values
+static inline byte config_values_channel(const setting_values_t &values, byte channel) {
   if (channel <= SM_INPUT_MAX)
-    return settings[current_setting].key_channel[channel] & 0x0f;
+    return values.key_channel[channel] & 0x0f;
   else
     return channel & 0x0f;
 }
 
+// get channel
+int config_get_output_channel(byte channel) {
+  config_read_t read;
+  return config_values_channel(*setting_values, channel);
+}
+
 // get channel
 void config_set_output_channel(byte channel, byte value) {
   thread_lock lock(config_lock);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].key_channel)) {
-    settings[current_setting].key_channel[channel] = value & 0x0f;
+  if (channel < ARRAY_COUNT(settings[current_setting]->key_channel)) {
+    settings[current_setting]->key_channel[channel] = value & 0x0f;
+    config_values_publish();
   }
 }
 
 // get midi program
 byte config_get_program(byte channel) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  channel = config_get_output_channel(channel);
+  channel = config_values_channel(values, channel);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].midi_program))
-    return settings[current_setting].midi_program[channel];
+  if (channel < ARRAY_COUNT(values.group->midi_program))
+    return values.group->midi_program[channel];
   else
     return 0;
 }
 
-// set midi program
+// set midi program, written in place so the audio thread never republishes
 void config_set_program(byte channel, byte value) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  channel = config_get_output_channel(channel);
+  channel = config_values_channel(values, channel);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].midi_program)) {
-    settings[current_setting].midi_program[channel] = value;
-  }
+  if (channel < ARRAY_COUNT(values.group->midi_program))
+    values.group->midi_program[channel] = value;
 }
 
-// get midi program
+// get midi controller
 byte config_get_controller(byte channel, byte id) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  channel = config_get_output_channel(channel);
+  channel = config_values_channel(values, channel);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].midi_controller))
-    return settings[current_setting].midi_controller[channel][id];
+  if (channel < ARRAY_COUNT(values.group->midi_controller))
+    return values.group->midi_controller[channel][id];
   else
     return -1;
 }
 
-// set midi program
+// set midi controller, written in place so the audio thread never republishes
 void config_set_controller(byte channel, byte id, byte value) {
-  thread_lock lock(config_lock);
+  config_read_t read;
+  const setting_values_t &values = *setting_values;
 
-  channel = config_get_output_channel(channel);
+  channel = config_values_channel(values, channel);
 
-  if (channel < ARRAY_COUNT(settings[current_setting].midi_controller)) {
-    settings[current_setting].midi_controller[channel][id] = value;
-  }
+  if (channel < ARRAY_COUNT(values.group->midi_controller))
+    values.group->midi_controller[channel][id] = value;
 }
 
 // reset config
@@ -960,6 +1371,10 @@ void config_set_setting_group(uint id) {
   if (id < setting_count)
     current_setting = id;
 
+  config_bind_publish();
+
+  config_values_publish();
+
   // update status
   for (int ch = 0; ch < 16; ch++) {
     for (int i = 0; i < 127; i++) {
@@ -974,9 +1389,19 @@ void config_set_setting_group(uint id) {
 
 // delete settting group
 void config_delete_setting_group(uint id) {
-  // move groups
-  for (uint i = id + 1; i < setting_count; ++i) {
-    settings[i - 1] = settings[i];
+  thread_lock lock(config_lock);
+
+  // move group to the end
+  if (id < setting_count) {
+    setting_t *group = settings[id];
+    key_bind_table_t *table = bind_tables[id];
+    bool dirty = bind_dirty[id];
+    memmove(&settings[id], &settings[id + 1], (setting_count - id - 1) * sizeof(settings[0]));
+    memmove(&bind_tables[id], &bind_tables[id + 1], (setting_count - id - 1) * sizeof(bind_tables[0]));
+    memmove(&bind_dirty[id], &bind_dirty[id + 1], (setting_count - id - 1) * sizeof(bind_dirty[0]));
+    settings[setting_count - 1] = group;
+    bind_tables[setting_count - 1] = table;
+    bind_dirty[setting_count - 1] = dirty;
   }
 
   // remove last group
@@ -988,16 +1413,24 @@ void config_delete_setting_group(uint id) {
 
 // insert setting group
 void config_insert_setting_group(uint pos) {
+  thread_lock lock(config_lock);
+
   if (pos > setting_count)
     pos = setting_count;
 
   // increase group count
   config_set_setting_group_count(setting_count + 1);
 
-  // move groups
-  for (uint i = setting_count - 1; i > pos; --i) {
-    settings[i] = settings[i - 1];
-  }
+  // move new group to position
+  setting_t *group = settings[setting_count - 1];
+  key_bind_table_t *table = bind_tables[setting_count - 1];
+  bool dirty = bind_dirty[setting_count - 1];
+  memmove(&settings[pos + 1], &settings[pos], (setting_count - pos - 1) * sizeof(settings[0]));
+  memmove(&bind_tables[pos + 1], &bind_tables[pos], (setting_count - pos - 1) * sizeof(bind_tables[0]));
+  memmove(&bind_dirty[pos + 1], &bind_dirty[pos], (setting_count - pos - 1) * sizeof(bind_dirty[0]));
+  settings[pos] = group;
+  bind_tables[pos] = table;
+  bind_dirty[pos] = dirty;
 
   // set current setting
   current_setting = pos;
@@ -1007,6 +1440,44 @@ void config_insert_setting_group(uint pos) {
   config_set_setting_group(pos);
 }
 
+// free a setting group
+static void config_setting_release(void *group) {
+  delete (setting_t*)group;
+}
+
+// allocate or free setting groups to the count
+static void config_resize_setting_groups(uint count) {
+  thread_lock lock(config_lock);
+
+  uint previous = setting_count;
+
+  for (uint i = 0; i < count; i++) {
+    if (settings[i] == NULL)
+      settings[i] = new setting_t;
+  }
+
+  setting_count = count;
+
+  // compile new groups
+  for (uint i = previous; i < count; i++)
+    config_bind_changed(i);
+
+  // move readers off removed groups before they are released
+  if (current_setting >= count)
+    current_setting = count - 1;
+
+  config_bind_publish();
+  config_values_publish();
+
+  for (uint i = count; i < ARRAY_COUNT(settings) && settings[i]; i++) {
+    config_retire(bind_tables[i], config_bind_release);
+    config_retire(settings[i], config_setting_release);
+    bind_tables[i] = NULL;
+    bind_dirty[i] = false;
+    settings[i] = NULL;
+  }
+}
+
 // get setting group count
 uint config_get_setting_group_count() {
   thread_lock lock(config_lock);
@@ -1026,12 +1497,464 @@ void config_set_setting_group_count(uint count) {
   // new setting id
   uint setting_id = current_setting < count ? current_setting : count - 1;
 
-  // clear newly added settings.
-  for (current_setting = setting_count; current_setting < count; current_setting++)
-    config_clear_key_setting();
+  // resize group table, new groups are cleared
+  config_resize_setting_groups(count);
 
   current_setting = setting_id;
-  setting_count = count;
+  config_bind_publish();
+  config_values_publish();
+}
+
+// saved setting groups
+struct config_state_t {
+  std::vector<setting_t> settings;
+  uint current_setting;
+  int output_volume;      // negative keeps current volume
+};
+
+// save setting groups
+config_state_t* config_save_state() {
+  thread_lock lock(config_lock);
+
+  config_state_t *state = new config_state_t;
+  for (uint i = 0; i < setting_count; i++)
+    state->settings.push_back(*settings[i]);
+
+  state->current_setting = current_setting;
+  state->output_volume = global.output_volume;
+  return state;
+}
+
+// restore setting groups
+void config_restore_state(config_state_t *state) {
+  thread_lock lock(config_lock);
+
+  if (state) {
+    config_resize_setting_groups(state->settings.size());
+
+    // only groups with another key map are compiled again
+    for (uint i = 0; i < setting_count; i++) {
+      bool changed = settings[i]->keymap.block != state->settings[i].keymap.block;
+
+      *settings[i] = state->settings[i];
+      if (changed)
+        config_bind_changed(i);
+    }
+
+    current_setting = state->current_setting;
+    if (state->output_volume >= 0)
+      global.output_volume = state->output_volume;
+    config_bind_update();
+    config_values_publish();
+  }
+}
+
+// free saved setting groups
+void config_free_state(config_state_t *state) {
+  delete state;
+}
+
+// setting groups prepared off the audio thread, after install it holds the replaced groups
+struct config_prepared_t {
+  setting_t *groups[256];
+  key_bind_table_t *tables[256];
+  uint count;
+  uint current;
+  int output_volume;
+};
+
+// prepare groups copied from setting groups
+static config_prepared_t* config_prepare_groups(const setting_t *groups, uint count, uint current, int output_volume) {
+  config_prepared_t *prepared = new config_prepared_t;
+
+  memset(prepared->groups, 0, sizeof(prepared->groups));
+  memset(prepared->tables, 0, sizeof(prepared->tables));
+  prepared->count = count;
+  prepared->current = current < count ? current : 0;
+  prepared->output_volume = output_volume;
+
+  for (uint i = 0; i < count; i++) {
+    prepared->groups[i] = new setting_t(groups[i]);
+    prepared->tables[i] = config_bind_compile(*prepared->groups[i]);
+
+    if (prepared->tables[i] == NULL) {
+      config_free_prepared(prepared);
+      return NULL;
+    }
+
+    prepared->tables[i]->version = 1;
+  }
+
+  return prepared;
+}
+
+// prepare a single cleared setting group
+config_prepared_t* config_prepare_clear() {
+  setting_t group;
+  return config_prepare_groups(&group, 1, 0, -1);
+}
+
+// prepare saved setting groups
+config_prepared_t* config_prepare_state(const config_state_t *state) {
+  if (state == NULL || state->settings.empty())
+    return NULL;
+
+  return config_prepare_groups(&state->settings[0], state->settings.size(), state->current_setting, state->output_volume);
+}
+
+// install prepared groups by swapping pointers, nothing is allocated or freed here.
+// values are published to a free snapshot, or later by config_values_update when
+// readers still hold all of them.
+void config_install_prepared(config_prepared_t *prepared) {
+  thread_lock lock(config_lock);
+
+  if (prepared == NULL || prepared->count == 0)
+    return;
+
+  uint count = prepared->count > setting_count ? prepared->count : setting_count;
+
+  for (uint i = 0; i < count; i++) {
+    setting_t *group = settings[i];
+    key_bind_table_t *table = bind_tables[i];
+
+    settings[i] = prepared->groups[i];
+    bind_tables[i] = prepared->tables[i];
+    bind_dirty[i] = false;
+    prepared->groups[i] = group;
+    prepared->tables[i] = table;
+  }
+
+  uint previous = setting_count;
+  setting_count = prepared->count;
+  current_setting = prepared->current;
+  prepared->count = previous;
+
+  if (prepared->output_volume >= 0)
+    global.output_volume = prepared->output_volume;
+
+  config_bind_publish();
+  config_values_publish();
+}
+
+// free prepared groups, or the groups they replaced
+void config_free_prepared(config_prepared_t *prepared) {
+  if (prepared) {
+    for (uint i = 0; i < ARRAY_COUNT(prepared->groups); i++) {
+      config_retire(prepared->tables[i], config_bind_release);
+      config_retire(prepared->groups[i], config_setting_release);
+    }
+
+    delete prepared;
+  }
+}
+
+// -----------------------------------------------------------------------------------------
+// setting snapshot
+// -----------------------------------------------------------------------------------------
+// setting groups are recorded into songs as one binary snapshot. every group is
+// serialized to a flat buffer with its keymaps at the end, and stored as the bytes that
+// differ from the previous group (a cleared group for the first one), so groups sharing
+// most of their settings cost a few bytes each.
+
+#define SETTING_SNAPSHOT_VERSION    1
+
+// write varint
+static void snapshot_put_varint(std::vector<byte> &data, uint value) {
+  while (value >= 0x80) {
+    data.push_back((byte)(value | 0x80));
+    value >>= 7;
+  }
+  data.push_back((byte)value);
+}
+
+// read varint, returns false at end of data
+static bool snapshot_get_varint(const byte *&data, const byte *end, uint *value) {
+  uint result = 0;
+
+  for (uint shift = 0; data < end && shift < 32; shift += 7) {
+    byte b = *data++;
+    result |= (uint)(b & 0x7f) << shift;
+
+    if ((b & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// write keymap as count and binds
+static void snapshot_put_keymap(std::vector<byte> &data, const std::multimap<byte, key_bind_t> &map) {
+  uint count = map.size();
+  data.push_back((byte)count);
+  data.push_back((byte)(count >> 8));
+  data.push_back((byte)(count >> 16));
+
+  for (auto it = map.begin(); it != map.end(); ++it) {
+    data.push_back(it->first);
+    data.push_back(it->second.a);
+    data.push_back(it->second.b);
+    data.push_back(it->second.c);
+    data.push_back(it->second.d);
+  }
+}
+
+// read keymap
+static bool snapshot_get_keymap(const byte *&data, const byte *end, std::multimap<byte, key_bind_t> &map) {
+  if (end - data < 3)
+    return false;
+
+  uint count = data[0] | (data[1] << 8) | (data[2] << 16);
+  data += 3;
+
+  if ((uint)(end - data) < count * 5)
+    return false;
+
+  map.clear();
+  for (uint i = 0; i < count; i++, data += 5)
+    map.insert(std::make_pair(data[0], key_bind_t(data[1], data[2], data[3], data[4])));
+
+  return true;
+}
+
+// serialize a setting group
+static void snapshot_put_setting(std::vector<byte> &data, const setting_t &s) {
+  const setting_labels_t &labels = s.labels.get();
+
+  data.clear();
+  data.push_back(s.key_signature);
+  data.insert(data.end(), s.key_octshift, ARRAY_END(s.key_octshift));
+  data.insert(data.end(), s.key_transpose, ARRAY_END(s.key_transpose));
+  data.insert(data.end(), s.key_velocity, ARRAY_END(s.key_velocity));
+  data.insert(data.end(), s.key_channel, ARRAY_END(s.key_channel));
+  data.insert(data.end(), s.follow_key, ARRAY_END(s.follow_key));
+  data.insert(data.end(), s.midi_program, ARRAY_END(s.midi_program));
+
+  for (int ch = 0; ch < 16; ch++)
+    data.insert(data.end(), s.midi_controller[ch], ARRAY_END(s.midi_controller[ch]));
+
+  for (int i = 0; i < 256; i++) {
+    uint color = labels.key_label[i].color;
+    data.insert(data.end(), labels.key_label[i].text, ARRAY_END(labels.key_label[i].text));
+    data.push_back((byte)color);
+    data.push_back((byte)(color >> 8));
+    data.push_back((byte)(color >> 16));
+    data.push_back((byte)(color >> 24));
+  }
+
+  snapshot_put_keymap(data, s.keymap.get().keydown_map);
+  snapshot_put_keymap(data, s.keymap.get().keyup_map);
+}
+
+// read array of chars
+static bool snapshot_get_bytes(const byte *&data, const byte *end, char *buffer, uint size) {
+  if ((uint)(end - data) < size)
+    return false;
+
+  memcpy(buffer, data, size);
+  data += size;
+  return true;
+}
+
+// bytes of buffer from pos to end equal those of previous buffer
+static bool snapshot_same_bytes(const std::vector<byte> &buffer, const std::vector<byte> &previous, uint pos, uint end) {
+  return end <= buffer.size() && end <= previous.size() &&
+         memcmp(&buffer[0] + pos, &previous[0] + pos, end - pos) == 0;
+}
+
+// deserialize a setting group, tables serialized like those of the previous group
+// share them instead of being copied.
+static bool snapshot_get_setting(const std::vector<byte> &buffer, const std::vector<byte> &previous_buffer,
+                                 const setting_t &previous, setting_t &s) {
+  if (buffer.empty())
+    return false;
+
+  const byte *data = &buffer[0];
+  const byte *end = data + buffer.size();
+
+  s.key_signature = *data++;
+
+  if (!snapshot_get_bytes(data, end, s.key_octshift, sizeof(s.key_octshift)) ||
+      !snapshot_get_bytes(data, end, s.key_transpose, sizeof(s.key_transpose)) ||
+      !snapshot_get_bytes(data, end, s.key_velocity, sizeof(s.key_velocity)) ||
+      !snapshot_get_bytes(data, end, s.key_channel, sizeof(s.key_channel)) ||
+      !snapshot_get_bytes(data, end, s.follow_key, sizeof(s.follow_key)) ||
+      !snapshot_get_bytes(data, end, s.midi_program, sizeof(s.midi_program)))
+    return false;
+
+  for (int ch = 0; ch < 16; ch++) {
+    if (!snapshot_get_bytes(data, end, s.midi_controller[ch], sizeof(s.midi_controller[ch])))
+      return false;
+  }
+
+  uint labels_start = data - &buffer[0];
+  uint labels_end = labels_start + 256 * (sizeof(previous.labels.get().key_label[0].text) + 4);
+
+  if (snapshot_same_bytes(buffer, previous_buffer, labels_start, labels_end)) {
+    s.labels = previous.labels;
+    data += labels_end - labels_start;
+  } else {
+    setting_labels_t &labels = s.labels.edit();
+
+    for (int i = 0; i < 256; i++) {
+      char color[4];
+
+      if (!snapshot_get_bytes(data, end, labels.key_label[i].text, sizeof(labels.key_label[i].text)) ||
+          !snapshot_get_bytes(data, end, color, sizeof(color)))
+        return false;
+
+      labels.key_label[i].always_0 = 0;
+      labels.key_label[i].color = (byte)color[0] | ((byte)color[1] << 8) | ((byte)color[2] << 16) | ((uint)(byte)color[3] << 24);
+    }
+  }
+
+  // keymaps are the rest of the buffer
+  uint keymap_start = data - &buffer[0];
+
+  if (buffer.size() == previous_buffer.size() &&
+      snapshot_same_bytes(buffer, previous_buffer, keymap_start, buffer.size())) {
+    s.keymap = previous.keymap;
+    return true;
+  }
+
+  setting_keymap_t &keymap = s.keymap.edit();
+
+  return snapshot_get_keymap(data, end, keymap.keydown_map) &&
+         snapshot_get_keymap(data, end, keymap.keyup_map) &&
+         data == end;
+}
+
+// bytes at position are unchanged long enough to start a new run
+static bool snapshot_same_run(const std::vector<byte> &current, const std::vector<byte> &previous, uint pos) {
+  for (uint i = pos; i < pos + 4 && i < current.size(); i++) {
+    if (i >= previous.size() || current[i] != previous[i])
+      return false;
+  }
+  return true;
+}
+
+// write buffer as runs of unchanged and changed bytes against previous one
+static void snapshot_put_delta(std::vector<byte> &data, const std::vector<byte> &current, const std::vector<byte> &previous) {
+  uint size = current.size();
+  uint i = 0;
+
+  snapshot_put_varint(data, size);
+
+  while (i < size) {
+    uint same = i;
+    while (same < size && same < previous.size() && current[same] == previous[same])
+      same++;
+
+    // short matches inside changed bytes are cheaper as literals
+    uint changed = same;
+    while (changed < size && !snapshot_same_run(current, previous, changed))
+      changed++;
+
+    snapshot_put_varint(data, same - i);
+    snapshot_put_varint(data, changed - same);
+    data.insert(data.end(), current.begin() + same, current.begin() + changed);
+    i = changed;
+  }
+}
+
+// read buffer encoded against previous one
+static bool snapshot_get_delta(const byte *&data, const byte *end, std::vector<byte> &current, const std::vector<byte> &previous) {
+  uint size;
+  if (!snapshot_get_varint(data, end, &size) || size > 16 * 1024 * 1024)
+    return false;
+
+  current.resize(size);
+  uint i = 0;
+
+  while (i < size) {
+    uint same, changed;
+
+    if (!snapshot_get_varint(data, end, &same) ||
+        !snapshot_get_varint(data, end, &changed))
+      return false;
+
+    if (same > size - i || i + same > previous.size() ||
+        changed > size - i - same || (uint)(end - data) < changed)
+      return false;
+
+    if (same)
+      memcpy(&current[i], &previous[i], same);
+    i += same;
+
+    if (changed)
+      memcpy(&current[i], data, changed);
+    data += changed;
+    i += changed;
+  }
+
+  return true;
+}
+
+// encode setting groups as a snapshot, returns snapshot size, buffer may be NULL
+uint config_encode_settings(byte *buffer, uint size) {
+  thread_lock lock(config_lock);
+
+  std::vector<byte> data;
+  std::vector<byte> current;
+  std::vector<byte> previous;
+
+  setting_t cleared;
+  cleared.clear();
+  snapshot_put_setting(previous, cleared);
+
+  data.push_back(SETTING_SNAPSHOT_VERSION);
+  snapshot_put_varint(data, setting_count);
+  snapshot_put_varint(data, current_setting);
+
+  for (uint i = 0; i < setting_count; i++) {
+    snapshot_put_setting(current, *settings[i]);
+    snapshot_put_delta(data, current, previous);
+    current.swap(previous);
+  }
+
+  if (buffer && size >= data.size())
+    memcpy(buffer, &data[0], data.size());
+
+  return data.size();
+}
+
+// decode a setting snapshot to a state for config_restore_state
+config_state_t* config_decode_settings(const byte *buffer, uint size) {
+  const byte *data = buffer;
+  const byte *end = buffer + size;
+  uint count;
+  uint current;
+
+  if (size == 0 || *data++ != SETTING_SNAPSHOT_VERSION)
+    return NULL;
+
+  if (!snapshot_get_varint(data, end, &count) ||
+      !snapshot_get_varint(data, end, &current) ||
+      count < 1 || count > ARRAY_COUNT(settings) || current >= count)
+    return NULL;
+
+  std::vector<setting_t> groups(count);
+  std::vector<byte> buffer_current;
+  std::vector<byte> buffer_previous;
+
+  setting_t cleared;
+  cleared.clear();
+  snapshot_put_setting(buffer_previous, cleared);
+
+  // first group shares empty tables with the cleared setting
+  for (uint i = 0; i < count; i++) {
+    if (!snapshot_get_delta(data, end, buffer_current, buffer_previous) ||
+        !snapshot_get_setting(buffer_current, buffer_previous, i > 0 ? groups[i - 1] : cleared, groups[i]))
+      return NULL;
+
+    buffer_current.swap(buffer_previous);
+  }
+
+  config_state_t *state = new config_state_t;
+  state->settings.swap(groups);
+  state->current_setting = current;
+  state->output_volume = -1;
+  return state;
 }
 
 // -----------------------------------------------------------------------------------------
@@ -1616,8 +2539,11 @@ int config_parse_keymap(const char *command, byte override_key, uint version) {
          line_end = line;
        }
 
-       if (*command == 0)
+       // binds are compiled once for the whole key map
+       if (*command == 0) {
+         config_bind_update();
          return result;
+       }
        break;
 
      default:
@@ -1656,6 +2582,7 @@ int config_load_keymap(const char *filename) {
   fclose(fp);
 
   // restore current group
+  config_bind_update();
   config_set_setting_group(0);
   return 0;
 }
@@ -1846,14 +2773,17 @@ static int config_save_keybind(int key, char *buff, int buffer_size) {
     }
   }
 
-  if (*config_bind_get_label(key)) {
+  char label[32];
+  config_bind_get_label(key, label, sizeof(label));
+
+  if (*label) {
     s += print_value(s, end - s, BIND_TYPE_LABEL, bind_names, ARRAYSIZE(bind_names), "");
     s += print_value(s, end - s, key, key_names, ARRAY_COUNT(key_names));
-    s += print_format(s, end - s, "\t%s\r\n", config_bind_get_label(key));
+    s += print_format(s, end - s, "\t%s\r\n", label);
   }
 
-  if (config_bind_get_color(key)) {
-    uint color = config_bind_get_color(key);
+  uint color = config_bind_get_color(key);
+  if (color) {
     byte a = color >> 24;
     byte r = color >> 16;
     byte g = color >> 8;
@@ -2055,7 +2985,9 @@ char* config_dump_keybind(byte code, uint lang) {
 void config_clear_key_setting() {
   thread_lock lock(config_lock);
 
-  settings[current_setting].clear();
+  settings[current_setting]->clear();
+  config_bind_changed(current_setting);
+  config_values_publish();
 }
 
 // copy key setting
@@ -2223,6 +3155,14 @@ int config_load(const char *filename) {
         match_number(&s, &value);
         config_set_key_fade(value);
       }
+      // record
+      else if (match_word(&s, "record")) {
+        if (match_word(&s, "thin")) {
+          uint value = 0;
+          match_number(&s, &value);
+          config_set_record_thin(value);
+        }
+      }
       else if (match_word(&s, "gui-transparency")) {
         uint value = 0;
         match_number(&s, &value);
@@ -2318,6 +3258,10 @@ int config_save(const char *filename) {
     fprintf(fp, "key-fade %d\r\n", config_get_key_fade());
   }
 
+  if (config_get_record_thin()) {
+    fprintf(fp, "record thin %d\r\n", config_get_record_thin());
+  }
+
   if (config_get_gui_transparency() != 255) {
     //fprintf(fp, "gui-transparency %d\r\n", config_get_gui_transparency());
   }
@@ -2938,6 +3882,17 @@ void config_set_key_fade(int value) {
   global.key_fade = value;
 }
 
+// controller thinning tolerance while recording
+int config_get_record_thin() {
+  thread_lock lock(config_lock);
+  return global.record_thin;
+}
+
+void config_set_record_thin(int value) {
+  thread_lock lock(config_lock);
+  global.record_thin = value;
+}
+
 void config_set_gui_transparency(byte value) {
   global.gui_transparency = value;
   HWND hwnd = gui_get_window();
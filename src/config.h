@@ -31,6 +31,33 @@ struct key_bind_t {
   key_bind_t(byte a, byte b, byte c, byte d) : a(a), b(b), c(c), d(d) {}
 };
 
+// lock-free read section for published config data, keep it short and never
+// call out or take a lock inside
+struct config_read_t {
+  config_read_t();
+  ~config_read_t();
+
+  long slot;
+};
+
+// compiled key binds of a setting group
+struct key_bind_table_t {
+  uint version;
+  uint keydown[257];      // keydown binds of key code i are binds[keydown[i]] ~ binds[keydown[i + 1]]
+  uint keyup[257];        // keyup binds of key code i are binds[keyup[i]] ~ binds[keyup[i + 1]]
+  key_bind_t binds[1];
+};
+
+// note translation of current setting group
+struct key_translate_t {
+  byte note[16][128];         // translated note of each input channel
+  byte velocity[16][128];     // translated velocity of each input channel
+  int shift[16];              // octave shift and transpose in semitones
+  byte key_velocity[16];
+  byte follow_key[16];
+  char key_signature;
+};
+
 struct midi_input_config_t {
   bool enable;
   int remap;
@@ -128,6 +155,16 @@ void config_bind_clear_keyup(byte code);
 int config_bind_get_keydown(byte code, key_bind_t *buffer, int size);
 int config_bind_get_keyup(byte code, key_bind_t *buffer, int size);
 
+// get compiled key binds of current setting group, call inside a read section.
+// returns NULL while binds changed and are not compiled yet
+const key_bind_table_t* config_bind_get_table();
+
+// compile key binds changed by add and clear, call once after a batch of changes
+void config_bind_update();
+
+// key binds wait for config_bind_update
+bool config_bind_deferred();
+
 // add key binding
 void config_bind_add_keydown(byte code, key_bind_t bind);
 void config_bind_add_keyup(byte code, key_bind_t bind);
@@ -136,7 +173,7 @@ void config_bind_add_keyup(byte code, key_bind_t bind);
 void config_bind_set_label(byte code, const char *label);
 
 // get bind label
-const char* config_bind_get_label(byte code);
+void config_bind_get_label(byte code, char *buffer, int size);
 
 // set bind color
 void config_bind_set_color(byte code, uint color);
@@ -156,6 +193,9 @@ void config_paste_key_setting();
 // default key setting
 void config_default_key_setting();
 
+// get note translation tables of current group, call inside a read section
+const key_translate_t* config_get_key_translate();
+
 // set key signature
 void config_set_key_signature(char key);
 
@@ -222,6 +262,46 @@ uint config_get_setting_group_count();
 // set setting group count
 void config_set_setting_group_count(uint count);
 
+// saved setting groups
+struct config_state_t;
+
+// save setting groups
+config_state_t* config_save_state();
+
+// restore setting groups
+void config_restore_state(config_state_t *state);
+
+// free saved setting groups
+void config_free_state(config_state_t *state);
+
+// setting groups prepared off the audio thread
+struct config_prepared_t;
+
+// prepare a single cleared setting group, returns NULL when out of memory
+config_prepared_t* config_prepare_clear();
+
+// prepare saved setting groups, returns NULL when out of memory
+config_prepared_t* config_prepare_state(const config_state_t *state);
+
+// install prepared groups without allocating, replaced groups are kept in prepared
+void config_install_prepared(config_prepared_t *prepared);
+
+// free prepared groups, or the groups they replaced
+void config_free_prepared(config_prepared_t *prepared);
+
+// publish setting values deferred because readers held every snapshot,
+// never called by the audio thread
+void config_values_update();
+
+// setting values wait for config_values_update
+bool config_values_deferred();
+
+// encode setting groups as a snapshot, returns snapshot size, buffer may be NULL
+uint config_encode_settings(byte *buffer, uint size);
+
+// decode a setting snapshot to a state for config_restore_state, returns NULL when invalid
+config_state_t* config_decode_settings(const byte *data, uint size);
+
 // get key name
 const char* config_get_key_name(byte code);
 
@@ -246,6 +326,10 @@ void config_set_instrument_show_vsti(bool value);
 int config_get_key_fade();
 void config_set_key_fade(int value);
 
+// controller thinning tolerance while recording, 0 disables
+int config_get_record_thin();
+void config_set_record_thin(int value);
+
 // gui transparency
 void config_set_gui_transparency(byte value);
 byte config_get_gui_transparency();
@@ -1661,6 +1661,20 @@ static inline uint hsv2color(float h, float s, float v, float alpha) {
 }
 
 static void update_keyboard(double fade) {
+  int shift[16];
+  byte key_velocity[16];
+  char key_signature;
+
+  // copy translation of current group, the read section must stay short
+  {
+    config_read_t read;
+    const key_translate_t *lut = config_get_key_translate();
+
+    memcpy(shift, lut->shift, sizeof(shift));
+    memcpy(key_velocity, lut->key_velocity, sizeof(key_velocity));
+    key_signature = lut->key_signature;
+  }
+
   for (KeyboardState *key = keyboard_states; key < keyboard_states + 256; key++) {
     if (key->x2 > key->x1) {
       key_bind_t map;
@@ -1680,7 +1694,7 @@ static void update_keyboard(double fade) {
       int notename = -1;
       if (map.a == SM_NOTE_ON || map.a == SM_NOTE_OFF) {
         byte ch = map.b;
-        note = map.c + config_get_key_octshift(ch) * 12 + config_get_key_transpose(ch);
+        note = map.c + (ch < 16 ? shift[ch] : 0);
 
         switch (config_get_note_display()) {
         case NOTE_DISPLAY_DOH:
@@ -1688,12 +1702,12 @@ static void update_keyboard(double fade) {
           break;
 
         case NOTE_DIAPLAY_FIXED_DOH:
-          note += config_get_key_signature();
+          note += key_signature;
           note = clamp_value(note, 0, 127);
           break;
 
         case NOTE_DISPLAY_NAME:
-          note += config_get_key_signature();
+          note += key_signature;
           notename = note;
           note = -1;
           break;
@@ -1710,7 +1724,8 @@ static void update_keyboard(double fade) {
       }
 
       // key label changed
-      const char *label = config_bind_get_label(key - keyboard_states);
+      char label[sizeof(key->label)];
+      config_bind_get_label(key - keyboard_states, label, sizeof(label));
       if (strcmp(label, key->label)) {
         strcpy_s(key->label, label);
         display_dirty = true;
@@ -1753,7 +1768,7 @@ static void update_keyboard(double fade) {
             case SM_NOTE_OFF:
             case SM_NOTE_PRESSURE:
               {
-                int vel = map.d * config_get_key_velocity(map.b) / 256;
+                int vel = map.d * (map.b < 16 ? key_velocity[map.b] : 127) / 256;
                 vel = clamp_value<int>(vel, 0, 64);
                 h = 64 - vel;
                 s = 1;
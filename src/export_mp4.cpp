@@ -162,7 +162,7 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
     float temp_buffer[2][32];
 
     // update song
-    song_update(1000.0 * (double)32 / (double)samples_per_sec);
+    song_update(32, samples_per_sec);
 
     // update effect
     vsti_update_config((float)samples_per_sec, 32);
@@ -296,7 +296,7 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
       double delta_time = (double)samples / (double)samples_per_sec;
 
       // update song
-      song_update(1000.0 * delta_time);
+      song_update(samples, samples_per_sec);
 
       // update effect
       vsti_update_config((float)samples_per_sec, samples);
@@ -0,0 +1,160 @@
+#include "pch.h"
+#include "export_trace.h"
+#include "export.h"
+#include "song.h"
+#include "midi.h"
+
+#include <vector>
+
+// trace file: header followed by one record for each output event
+static const char trace_magic[] = "FreePianoTrace";
+static const uint trace_version = 1;
+
+struct trace_header_t {
+  char magic[16];
+  uint version;
+  uint sample_rate;
+  uint block_size;
+  uint event_count;
+};
+
+struct trace_event_t {
+  uint sample;
+  byte a;
+  byte b;
+  byte c;
+  byte d;
+};
+
+// collect output events with their sample position
+struct trace_recorder_t : midi_output_callback {
+  std::vector<trace_event_t> events;
+  uint block_start;
+
+  trace_recorder_t() : block_start(0) {}
+
+  void operator () (byte a, byte b, byte c, byte d) {
+    trace_event_t e;
+    e.sample = block_start + song_get_event_offset();
+    e.a = a;
+    e.b = b;
+    e.c = c;
+    e.d = d;
+    events.push_back(e);
+  }
+};
+
+// write trace file
+static int trace_write(const char *filename, const trace_header_t &header, const std::vector<trace_event_t> &events) {
+  FILE *fp = fopen(filename, "wb");
+  if (!fp)
+    return -1;
+
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+  if (ok && !events.empty())
+    ok = fwrite(&events[0], sizeof(trace_event_t), events.size(), fp) == events.size();
+
+  fclose(fp);
+  return ok ? 0 : -1;
+}
+
+// read trace file
+static int trace_read(const char *filename, trace_header_t &header, std::vector<trace_event_t> &events) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return -1;
+
+  bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+            memcmp(header.magic, trace_magic, sizeof(trace_magic)) == 0 &&
+            header.version == trace_version;
+
+  if (ok) {
+    events.resize(header.event_count);
+    if (header.event_count)
+      ok = fread(&events[0], sizeof(trace_event_t), events.size(), fp) == events.size();
+  }
+
+  fclose(fp);
+  return ok ? 0 : -1;
+}
+
+// index of first differing event, -1 when traces are equal
+static int trace_compare(const trace_header_t &h1, const std::vector<trace_event_t> &e1,
+                         const trace_header_t &h2, const std::vector<trace_event_t> &e2) {
+  if (h1.sample_rate != h2.sample_rate || h1.block_size != h2.block_size)
+    return 0;
+
+  size_t count = e1.size() < e2.size() ? e1.size() : e2.size();
+
+  for (size_t i = 0; i < count; i++) {
+    if (memcmp(&e1[i], &e2[i], sizeof(trace_event_t)) != 0)
+      return (int)i;
+  }
+
+  return e1.size() == e2.size() ? -1 : (int)count;
+}
+
+// play song headless and trace output events
+int export_trace(const char *filename, const char *golden, uint block_size, uint sample_rate, export_trace_result_t *result) {
+  trace_recorder_t recorder;
+  LARGE_INTEGER frequency, start, end;
+
+  result->events = 0;
+  result->seconds = 0;
+  result->mismatch = -1;
+
+  if (block_size == 0 || sample_rate == 0)
+    return -1;
+
+  // stop at twice the song length if the song never stops itself
+  double max_samples = 2.0 * (song_get_length() + 1000) * sample_rate / 1000;
+
+  export_start();
+  song_stop_playback();
+
+  recorder.events.reserve(65536);
+  midi_set_output_trace(&recorder);
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&start);
+
+  song_start_playback();
+
+  while (song_is_playing() && recorder.block_start < max_samples) {
+    song_update(block_size, sample_rate);
+    recorder.block_start += block_size;
+  }
+
+  QueryPerformanceCounter(&end);
+
+  midi_set_output_trace(NULL);
+  song_stop_playback();
+  export_done();
+
+  trace_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, trace_magic, sizeof(trace_magic));
+  header.version = trace_version;
+  header.sample_rate = sample_rate;
+  header.block_size = block_size;
+  header.event_count = recorder.events.size();
+
+  result->events = recorder.events.size();
+  result->seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+  if (trace_write(filename, header, recorder.events))
+    return -1;
+
+  if (golden) {
+    trace_header_t golden_header;
+    std::vector<trace_event_t> golden_events;
+
+    if (trace_read(golden, golden_header, golden_events))
+      return -1;
+
+    result->mismatch = trace_compare(header, recorder.events, golden_header, golden_events);
+  }
+
+  return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// result of a trace run
+struct export_trace_result_t {
+  uint events;          // events sent to output
+  double seconds;       // time spent updating the song
+  int mismatch;         // first event differing from golden trace, -1 when equal
+};
+
+// play song headless at fixed block size and write output events to a trace file,
+// the trace is compared with golden trace when one is given
+int export_trace(const char *filename, const char *golden, uint block_size, uint sample_rate, export_trace_result_t *result);
@@ -559,8 +559,8 @@ static inline short convertSample(float value) {
   return short(value);
 }
 
-// export thread
-static DWORD __stdcall export_rendering_thread(void *parameter) {
+// render song to wave file, progress is reported to gui when interactive
+static HRESULT export_wav_render(const char *filename, bool interactive) {
   const int samples_per_sec = 44100;
   uint progress = 0;
 
@@ -576,7 +576,7 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
   HRESULT hr;
   CWaveFile wavFile;
 
-  hr = wavFile.Open((char*)parameter, &wfxInput, WAVEFILE_WRITE);
+  hr = wavFile.Open((char*)filename, &wfxInput, WAVEFILE_WRITE);
   if (FAILED(hr)) {
     goto done;
   }
@@ -590,7 +590,7 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
     float temp_buffer[2][32];
 
     // update song
-    song_update(1000.0 * (double)32 / (double)samples_per_sec);
+    song_update(32, samples_per_sec);
 
     // update effect
     vsti_update_config((float)samples_per_sec, 32);
@@ -608,7 +608,7 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
     short output_buffer[2 * samples];
 
     // update song
-    song_update(1000.0 * (double)samples / (double)samples_per_sec);
+    song_update(samples, samples_per_sec);
 
     // update effect
     vsti_update_config((float)samples_per_sec, samples);
@@ -631,6 +631,9 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
     if (!song_is_playing())
       break;
 
+    if (!interactive)
+      continue;
+
     if (!gui_is_exporting())
       break;
 
@@ -643,11 +646,17 @@ static DWORD __stdcall export_rendering_thread(void *parameter) {
 
 done:
   song_stop_playback();
-  gui_close_export_progress();
+  if (interactive)
+    gui_close_export_progress();
   wavFile.Close();
   return hr;
 }
 
+// export thread
+static DWORD __stdcall export_rendering_thread(void *parameter) {
+  return export_wav_render((const char *)parameter, true);
+}
+
 // export mp4
 int export_wav(const char *filename) {
   export_start();
@@ -660,4 +669,13 @@ int export_wav(const char *filename) {
 
   export_done();
   return 0;
+}
+
+// export wav without gui
+int export_wav_offline(const char *filename) {
+  export_start();
+  HRESULT hr = export_wav_render(filename, false);
+  export_done();
+
+  return FAILED(hr) ? -1 : 0;
 }
\ No newline at end of file
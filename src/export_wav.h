@@ -1,4 +1,7 @@
 #pragma once
 
 // export mp4
-int export_wav(const char *filename);
\ No newline at end of file
+int export_wav(const char *filename);
+
+// export wav in calling thread without gui
+int export_wav_offline(const char *filename);
\ No newline at end of file
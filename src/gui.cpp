@@ -64,7 +64,8 @@ static bool open_dialog(char *buff, size_t size, const char* filters, const char
   return GetOpenFileName(&ofn) != 0;
 }
 
-static bool save_dialog(char *buff, size_t size, const char *filters, const char* init_dir = NULL) {
+// returns selected filter index, 0 when canceled
+static int save_dialog(char *buff, size_t size, const char *filters, const char* init_dir = NULL) {
   char dir[260] = {0};
 
   OPENFILENAME ofn;
@@ -86,7 +87,7 @@ static bool save_dialog(char *buff, size_t size, const char *filters, const char
     ofn.lpstrInitialDir = dir;
   }
 
-  return GetSaveFileName(&ofn) != 0;
+  return GetSaveFileName(&ofn) ? ofn.nFilterIndex : 0;
 }
 
 
@@ -1169,6 +1170,9 @@ int gui_show_song_info() {
 static byte selected_key = 0;
 static byte preview_key = 0;
 
+// loop start picked from file menu
+static int loop_start_time = 0;
+
 static HMENU menu_main = NULL;
 static HMENU menu_record = NULL;
 static HMENU menu_output = NULL;
@@ -1201,8 +1205,12 @@ enum MENU_ID {
   MENU_ID_FILE_OPEN,
   MENU_ID_FILE_SAVE,
   MENU_ID_FILE_RECORD,
+  MENU_ID_FILE_OVERDUB,
   MENU_ID_FILE_PLAY,
   MENU_ID_FILE_STOP,
+  MENU_ID_FILE_LOOP_START,
+  MENU_ID_FILE_LOOP_END,
+  MENU_ID_FILE_LOOP_CLEAR,
   MENU_ID_FILE_EXPORT_MP4,
   MENU_ID_FILE_EXPORT_WAV,
   MENU_ID_FILE_INFO,
@@ -1263,9 +1271,14 @@ static int menu_init() {
   AppendMenu(menu_record, MF_POPUP, (UINT_PTR)menu_export, lang_load_string(IDS_MENU_FILE_EXPORT));
   AppendMenu(menu_record, MF_SEPARATOR, 0, NULL);
   AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_RECORD, lang_load_string(IDS_MENU_FILE_RECORD));
+  AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_OVERDUB, lang_load_string(IDS_MENU_FILE_OVERDUB));
   AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_PLAY, lang_load_string(IDS_MENU_FILE_PLAY));
   AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_STOP, lang_load_string(IDS_MENU_FILE_STOP));
   AppendMenu(menu_record, MF_SEPARATOR, 0, NULL);
+  AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_LOOP_START, lang_load_string(IDS_MENU_FILE_LOOP_START));
+  AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_LOOP_END, lang_load_string(IDS_MENU_FILE_LOOP_END));
+  AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_LOOP_CLEAR, lang_load_string(IDS_MENU_FILE_LOOP_CLEAR));
+  AppendMenu(menu_record, MF_SEPARATOR, 0, NULL);
   AppendMenu(menu_record, MF_STRING, (UINT_PTR)MENU_ID_FILE_INFO, lang_load_string(IDS_MENU_FILE_INFO));
 
   AppendMenu(menu_export, MF_STRING, (UINT_PTR)MENU_ID_FILE_EXPORT_MP4, lang_load_string(IDS_MENU_FILE_EXPORT_MP4));
@@ -1428,6 +1441,9 @@ int menu_on_command(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
 
        else if (strcmp(extension, ".fpm") == 0)
          try_open_song(song_open(temp));
+
+       else if (strcmp(extension, ".mid") == 0 || strcmp(extension, ".midi") == 0)
+         try_open_song(song_open_midi(temp));
      }
    }
    break;
@@ -1437,9 +1453,18 @@ int menu_on_command(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
 
      if (result) {
        char temp[260];
-       if (save_dialog(temp, sizeof(temp), lang_load_string(IDS_SAVE_FILTER_SONG), "song\\")) {
-         PathRenameExtension(temp, ".fpm");
-         int result = song_save(temp);
+       int filter = save_dialog(temp, sizeof(temp), lang_load_string(IDS_SAVE_FILTER_SONG), "song\\");
+
+       if (filter) {
+         int result;
+
+         if (filter == 2) {
+           PathRenameExtension(temp, ".mid");
+           result = song_save_midi(temp);
+         } else {
+           PathRenameExtension(temp, ".fpm");
+           result = song_save(temp);
+         }
 
          if (result != 0) {
            MessageBox(gui_get_window(), lang_load_string(IDS_ERR_SAVE_SONG), APP_NAME, MB_OK);
@@ -1453,6 +1478,10 @@ int menu_on_command(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
      song_start_record();
      break;
 
+   case MENU_ID_FILE_OVERDUB:
+     song_start_overdub();
+     break;
+
    case MENU_ID_FILE_PLAY:
      song_start_playback();
      break;
@@ -1462,6 +1491,18 @@ int menu_on_command(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
      song_stop_record();
      break;
 
+   case MENU_ID_FILE_LOOP_START:
+     loop_start_time = song_get_time();
+     break;
+
+   case MENU_ID_FILE_LOOP_END:
+     song_set_loop(loop_start_time, song_get_time());
+     break;
+
+   case MENU_ID_FILE_LOOP_CLEAR:
+     song_set_loop(0, 0);
+     break;
+
    case MENU_ID_FILE_INFO:
      gui_show_song_info();
      break;
@@ -1710,7 +1751,14 @@ int menu_on_popup(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
       EnableMenuItem(menu, MENU_ID_FILE_SAVE, MF_BYCOMMAND | (song_allow_save() ? MF_ENABLED : MF_DISABLED));
       EnableMenuItem(menu, MENU_ID_FILE_PLAY, MF_BYCOMMAND | (!song_is_empty() && !song_is_recording() && !song_is_playing() ? MF_ENABLED : MF_DISABLED));
       EnableMenuItem(menu, MENU_ID_FILE_STOP, MF_BYCOMMAND | (song_is_playing() || song_is_recording() ? MF_ENABLED : MF_DISABLED));
+
+      int loop_start, loop_end;
+      bool enable_loop = song_is_playing() && !song_is_recording();
+      EnableMenuItem(menu, MENU_ID_FILE_LOOP_START, MF_BYCOMMAND | (enable_loop ? MF_ENABLED : MF_DISABLED));
+      EnableMenuItem(menu, MENU_ID_FILE_LOOP_END, MF_BYCOMMAND | (enable_loop && song_get_time() > loop_start_time ? MF_ENABLED : MF_DISABLED));
+      EnableMenuItem(menu, MENU_ID_FILE_LOOP_CLEAR, MF_BYCOMMAND | (song_get_loop(&loop_start, &loop_end) ? MF_ENABLED : MF_DISABLED));
       EnableMenuItem(menu, MENU_ID_FILE_RECORD, MF_BYCOMMAND | (!song_is_recording() ? MF_ENABLED : MF_DISABLED));
+      EnableMenuItem(menu, MENU_ID_FILE_OVERDUB, MF_BYCOMMAND | (song_allow_overdub() && !song_is_playing() ? MF_ENABLED : MF_DISABLED));
 
       bool enable_export = (config_get_instrument_type() == INSTRUMENT_TYPE_VSTI) && !song_is_empty();
       EnableMenuItem(menu, (UINT)menu_export, MF_BYCOMMAND | (enable_export ? MF_ENABLED : MF_DISABLED));
@@ -1840,6 +1888,7 @@ static INT_PTR CALLBACK key_setting_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LP
       config_bind_clear_keydown(selected_key);
       config_bind_clear_keyup(selected_key);
       config_bind_add_keydown(selected_key, keydown);
+      config_bind_update();
     }
   };
 
@@ -1995,6 +2044,7 @@ static INT_PTR CALLBACK key_setting_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LP
          config_bind_set_color(selected_key, 0);
          config_bind_clear_keydown(selected_key);
          config_bind_clear_keyup(selected_key);
+         config_bind_update();
          helpers::refresh_controls(hWnd);
        }
 
@@ -2043,6 +2093,7 @@ static INT_PTR CALLBACK key_setting_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LP
                  }
                }
                lang_text_close();
+               config_bind_update();
              }
            }
            helpers::refresh_controls(hWnd);
@@ -2241,6 +2292,11 @@ static LRESULT CALLBACK windowproc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
          return 0;
        }
 
+       if (_stricmp(extension, ".mid") == 0 || _stricmp(extension, ".midi") == 0) {
+         try_open_song(song_open_midi(filepath));
+         return 0;
+       }
+
        // drop a instrument
        if (_stricmp(extension, ".dll") == 0) {
          config_select_instrument(INSTRUMENT_TYPE_VSTI, filepath);
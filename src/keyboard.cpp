@@ -7,10 +7,27 @@
 #include "song.h"
 #include "export.h"
 
-#include <map>
+#include <vector>
 
-// auto generated keyup events
-static std::multimap<byte, key_bind_t> key_up_map;
+// auto generated keyup events of a key
+struct keyboard_keyup_t {
+  uint generation;
+  uint count;
+  key_bind_t binds[16];
+};
+
+// keyup slot of each key, slots of old generation are empty
+static keyboard_keyup_t keyboard_keyup[256];
+static uint keyboard_keyup_generation = 1;
+
+// keyup events that do not fit in the slot of their key, dropped when this is full too
+struct keyboard_keyup_overflow_t {
+  byte code;
+  key_bind_t bind;
+};
+
+static keyboard_keyup_overflow_t keyboard_keyup_overflow[256];
+static uint keyboard_keyup_overflow_count = 0;
 
 // keyboard status
 static byte keyboard_status[256] = {0};
@@ -99,7 +116,7 @@ static LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lP
 
     // trigger event only when key changed
     if (keydown_status[code] != keydown) {
-      song_send_event(SM_SYSTEM, SMS_KEY_EVENT, code, keydown, true);
+      song_queue_event(SM_SYSTEM, SMS_KEY_EVENT, code, keydown);
       keydown_status[code] = keydown;
     }
 
@@ -155,6 +172,8 @@ void keyboard_enable(bool enable) {
 
 // reset keyboard
 void keyboard_reset() {
+  thread_lock lock(keyboard_lock);
+
   for (int i = 0; i < ARRAY_COUNT(keyboard_status); i++) {
     if (keyboard_status[i] || keydown_status[i]) {
       // send keyup event
@@ -163,6 +182,10 @@ void keyboard_reset() {
       keydown_status[i] = 0;
     }
   }
+
+  // drop all remaining keyup events
+  keyboard_keyup_generation++;
+  keyboard_keyup_overflow_count = 0;
 }
 
 // enum keymap
@@ -192,6 +215,24 @@ static inline byte clamp_value(int data, byte min = 0, byte max = 127) {
   return data;
 }
 
+// add a keyup event to the slot of a key
+static void keyboard_keyup_add(byte code, const key_bind_t &bind) {
+  keyboard_keyup_t &slot = keyboard_keyup[code];
+
+  if (slot.generation != keyboard_keyup_generation) {
+    slot.generation = keyboard_keyup_generation;
+    slot.count = 0;
+  }
+
+  if (slot.count < ARRAY_COUNT(slot.binds)) {
+    slot.binds[slot.count++] = bind;
+  } else if (keyboard_keyup_overflow_count < ARRAY_COUNT(keyboard_keyup_overflow)) {
+    keyboard_keyup_overflow[keyboard_keyup_overflow_count].code = code;
+    keyboard_keyup_overflow[keyboard_keyup_overflow_count].bind = bind;
+    keyboard_keyup_overflow_count++;
+  }
+}
+
 // keyboard event
 void keyboard_send_event(int code, int keydown) {
   thread_lock lock(keyboard_lock);
@@ -202,12 +243,37 @@ void keyboard_send_event(int code, int keydown) {
 
   // keydown event
   if (keydown) {
-    key_bind_t temp[256];
+    key_bind_t keydown_binds[256];
+    key_bind_t keyup_binds[256];
+    uint num_keydown = 0;
+    uint num_keyup = 0;
+    bool compiled = false;
+
+    // copy key binds from compiled table of current group
+    {
+      config_read_t read;
+      const key_bind_table_t *table = config_bind_get_table();
+
+      if (table) {
+        for (uint i = table->keydown[code]; i < table->keydown[code + 1] && num_keydown < ARRAY_COUNT(keydown_binds); i++)
+          keydown_binds[num_keydown++] = table->binds[i];
+
+        for (uint i = table->keyup[code]; i < table->keyup[code + 1] && num_keyup < ARRAY_COUNT(keyup_binds); i++)
+          keyup_binds[num_keyup++] = table->binds[i];
+
+        compiled = true;
+      }
+    }
+
+    // binds changed and are not compiled yet
+    if (!compiled) {
+      num_keydown = config_bind_get_keydown(code, keydown_binds, ARRAY_COUNT(keydown_binds));
+      num_keyup = config_bind_get_keyup(code, keyup_binds, ARRAY_COUNT(keyup_binds));
+    }
 
     // get key bind
-    int num_keydown = config_bind_get_keydown(code, temp, ARRAYSIZE(temp));
-    for (int i = 0; i < num_keydown; i++) {
-      key_bind_t down = temp[i];
+    for (uint i = 0; i < num_keydown; i++) {
+      key_bind_t down = keydown_binds[i];
 
       // translate to real midi event
       song_translate_note(down.a, down.b, down.c, down.d);
@@ -223,7 +289,7 @@ void keyboard_send_event(int code, int keydown) {
         up.b = down.b;
         up.c = down.c;
         up.d = down.d;
-        key_up_map.insert(std::pair<byte, key_bind_t>(code, up));
+        keyboard_keyup_add(code, up);
       }
 
       // send event to song
@@ -231,20 +297,19 @@ void keyboard_send_event(int code, int keydown) {
     }
 
     // add key up events.
-    int num_keyup = config_bind_get_keyup(code, temp, ARRAYSIZE(temp));
-    for (int i = 0; i < num_keyup; i++) {
-      key_bind_t up = temp[i];
+    for (uint i = 0; i < num_keyup; i++) {
+      key_bind_t up = keyup_binds[i];
 
       // translate to real midi event
       song_translate_note(up.a, up.b, up.c, up.d);
 
-      // insert keyup event to keyup map
-      key_up_map.insert(std::pair<byte, key_bind_t>(code, up));
+      // insert keyup event to keyup slot
+      keyboard_keyup_add(code, up);
 
       // generate a keyup event
       if ((up.a & 0xf0) == SM_MIDI_NOTEON) {
         up.a = SM_MIDI_NOTEOFF | (up.a & 0x0f);
-        key_up_map.insert(std::pair<byte, key_bind_t>(code, up));
+        keyboard_keyup_add(code, up);
       }
     }
 
@@ -253,17 +318,44 @@ void keyboard_send_event(int code, int keydown) {
   }
   // keyup event
   else {
-    auto it = key_up_map.find(code);
-    while (it != key_up_map.end() && it->first == code) {
-      key_bind_t &up = it->second;
+    keyboard_keyup_t &slot = keyboard_keyup[(byte)code];
+
+    if (slot.generation == keyboard_keyup_generation) {
+      // clear slot first, events may press keys again
+      uint count = slot.count;
+      key_bind_t binds[ARRAY_COUNT(slot.binds)];
+      memcpy(binds, slot.binds, count * sizeof(key_bind_t));
+      slot.count = 0;
+
+      // overflowed events of this key
+      key_bind_t overflow[ARRAY_COUNT(keyboard_keyup_overflow)];
+      uint overflow_count = 0;
+
+      for (uint i = 0; i < keyboard_keyup_overflow_count;) {
+        if (keyboard_keyup_overflow[i].code == (byte)code) {
+          overflow[overflow_count++] = keyboard_keyup_overflow[i].bind;
+          keyboard_keyup_overflow[i] = keyboard_keyup_overflow[--keyboard_keyup_overflow_count];
+        } else {
+          i++;
+        }
+      }
+
+      for (uint i = 0; i < count; i++) {
+        key_bind_t &up = binds[i];
 
-      if (up.a) {
-        song_output_event(up.a, up.b, up.c, up.d);
+        if (up.a) {
+          song_output_event(up.a, up.b, up.c, up.d);
+        }
       }
 
-      ++it;
+      for (uint i = 0; i < overflow_count; i++) {
+        key_bind_t &up = overflow[i];
+
+        if (up.a) {
+          song_output_event(up.a, up.b, up.c, up.d);
+        }
+      }
     }
-    key_up_map.erase(code);
   }
 }
 
@@ -274,4 +366,52 @@ void keyboard_update(double time_elapsed) {
 // get keyboard status
 byte keyboard_get_status(byte code) {
   return keyboard_status[code];
+}
+
+// saved keyboard state
+struct keyboard_state_t {
+  byte status[256];
+  std::vector<std::pair<byte, key_bind_t> > keyup;
+};
+
+// save keyboard status and pending keyup events
+keyboard_state_t* keyboard_save_state() {
+  thread_lock lock(keyboard_lock);
+
+  keyboard_state_t *state = new keyboard_state_t;
+  memcpy(state->status, keyboard_status, sizeof(keyboard_status));
+
+  // only live slots are saved
+  for (int i = 0; i < 256; i++) {
+    const keyboard_keyup_t &slot = keyboard_keyup[i];
+
+    if (slot.generation == keyboard_keyup_generation) {
+      for (uint j = 0; j < slot.count; j++)
+        state->keyup.push_back(std::make_pair((byte)i, slot.binds[j]));
+    }
+  }
+
+  for (uint i = 0; i < keyboard_keyup_overflow_count; i++)
+    state->keyup.push_back(std::make_pair(keyboard_keyup_overflow[i].code, keyboard_keyup_overflow[i].bind));
+
+  return state;
+}
+
+// restore keyboard state, no event is sent and nothing is allocated
+void keyboard_restore_state(keyboard_state_t *state) {
+  thread_lock lock(keyboard_lock);
+
+  if (state) {
+    memcpy(keyboard_status, state->status, sizeof(keyboard_status));
+    keyboard_keyup_generation++;
+    keyboard_keyup_overflow_count = 0;
+
+    for (uint i = 0; i < state->keyup.size(); i++)
+      keyboard_keyup_add(state->keyup[i].first, state->keyup[i].second);
+  }
+}
+
+// free saved keyboard state
+void keyboard_free_state(keyboard_state_t *state) {
+  delete state;
 }
\ No newline at end of file
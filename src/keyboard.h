@@ -28,4 +28,16 @@ void keyboard_send_event(int code, int keydown);
 void keyboard_update(double time_elapsed);
 
 // get keyboard status
-byte keyboard_get_status(byte code);
\ No newline at end of file
+byte keyboard_get_status(byte code);
+
+// saved keyboard state
+struct keyboard_state_t;
+
+// save keyboard status and pending keyup events
+keyboard_state_t* keyboard_save_state();
+
+// restore keyboard state, no event is sent
+void keyboard_restore_state(keyboard_state_t *state);
+
+// free saved keyboard state
+void keyboard_free_state(keyboard_state_t *state);
\ No newline at end of file
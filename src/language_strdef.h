@@ -73,9 +73,21 @@ STR_SCHINESE (IDS_MENU_FILE_EXPORT_WAV, "
 STR_ENGLISH  (IDS_MENU_FILE_INFO, "Information")
 STR_SCHINESE (IDS_MENU_FILE_INFO, "Ϣ")
 
+STR_ENGLISH  (IDS_MENU_FILE_LOOP_CLEAR, "Clear Loop")
+STR_SCHINESE (IDS_MENU_FILE_LOOP_CLEAR, "ȡѭ")
+
+STR_ENGLISH  (IDS_MENU_FILE_LOOP_END, "Set Loop End")
+STR_SCHINESE (IDS_MENU_FILE_LOOP_END, "ѭյ")
+
+STR_ENGLISH  (IDS_MENU_FILE_LOOP_START, "Set Loop Start")
+STR_SCHINESE (IDS_MENU_FILE_LOOP_START, "ѭ")
+
 STR_ENGLISH  (IDS_MENU_FILE_OPEN, "Open...")
 STR_SCHINESE (IDS_MENU_FILE_OPEN, "...")
 
+STR_ENGLISH  (IDS_MENU_FILE_OVERDUB, "Overdub")
+STR_SCHINESE (IDS_MENU_FILE_OVERDUB, "¼")
+
 STR_ENGLISH  (IDS_MENU_FILE_PLAY, "Play")
 STR_SCHINESE (IDS_MENU_FILE_PLAY, "")
 
@@ -199,8 +211,8 @@ STR_SCHINESE (IDS_MIDI_INPUT_LIST_REMAP_OUTPUT, "
 STR_ENGLISH  (IDS_MIDI_INPUT_LIST_REMAP_INPUT, "In %d")
 STR_SCHINESE (IDS_MIDI_INPUT_LIST_REMAP_INPUT, " %d")
 
-STR_ENGLISH  (IDS_OPEN_FILTER_SONG, "All songs (*.fpm, *.lyt)\0*.fpm;*.lyt\0")
-STR_SCHINESE (IDS_OPEN_FILTER_SONG, " (*.fpm, *.lyt)\0*.fpm;*.lyt\0")
+STR_ENGLISH  (IDS_OPEN_FILTER_SONG, "All songs (*.fpm, *.lyt, *.mid)\0*.fpm;*.lyt;*.mid;*.midi\0")
+STR_SCHINESE (IDS_OPEN_FILTER_SONG, " (*.fpm, *.lyt, *.mid)\0*.fpm;*.lyt;*.mid;*.midi\0")
 
 STR_ENGLISH  (IDS_OPEN_FILTER_VST, "VST plugins (*.dll)\0*.dll\0")
 STR_SCHINESE (IDS_OPEN_FILTER_VST, "VST  (*.dll)\0*.dll\0")
@@ -208,8 +220,8 @@ STR_SCHINESE (IDS_OPEN_FILTER_VST, "VST 
 STR_ENGLISH  (IDS_SAVE_FILTER_MP4, "Video files (*.mp4)\0*.mp4\0")
 STR_SCHINESE (IDS_SAVE_FILTER_MP4, "Ƶļ (*.mp4)\0*.mp4\0")
 
-STR_ENGLISH  (IDS_SAVE_FILTER_SONG, "FreePiano song (*.fpm)\0*.fpm\0")
-STR_SCHINESE (IDS_SAVE_FILTER_SONG, "FreePiano (*.fpm)\0*.fpm\0")
+STR_ENGLISH  (IDS_SAVE_FILTER_SONG, "FreePiano song (*.fpm)\0*.fpm\0MIDI file (*.mid)\0*.mid\0")
+STR_SCHINESE (IDS_SAVE_FILTER_SONG, "FreePiano (*.fpm)\0*.fpm\0MIDIļ (*.mid)\0*.mid\0")
 
 STR_ENGLISH  (IDS_SAVE_FILTER_WAV, "Wave files (*.wav)\0*.wav\0")
 STR_SCHINESE (IDS_SAVE_FILTER_WAV, "Ƶļ (*.wav)\0*.wav\0")
@@ -404,6 +416,9 @@ STR_SCHINESE (IDS_SONG_INFO_OK, "ȷ
 STR_ENGLISH  (IDS_SONG_INFO_CANCEL, "Cancel")
 STR_SCHINESE (IDS_SONG_INFO_CANCEL, "ȡ")
 
+STR_ENGLISH  (IDS_SONG_RECOVERED, "An unsaved recording from the last session was recovered.")
+STR_SCHINESE (IDS_SONG_RECOVERED, "ѻָϴδ¼ơ")
+
 // Exporting dialog
 STR_ENGLISH  (IDS_EXPORTING_CAPTION, "Exporting...")
 STR_SCHINESE (IDS_EXPORTING_CAPTION, "ڵ...")
@@ -7,6 +7,7 @@
 #include "export_mp4.h"
 #include "language.h"
 #include "update.h"
+#include "batch.h"
 
 #ifdef _DEBUG
 int main()
@@ -20,6 +21,13 @@ int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmd
   if (FAILED(CoInitialize(NULL)))
     return 1;
 
+  // command line conversion
+  if (batch_requested()) {
+    int result = batch_main();
+    CoUninitialize();
+    return result;
+  }
+
   // config init
   if (config_init()) {
     MessageBox(NULL, lang_get_last_error(), APP_NAME, MB_OK);
@@ -47,12 +55,24 @@ int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmd
     return 1;
   }
 
+  // initialize song
+  if (song_init()) {
+    MessageBox(NULL, lang_get_last_error(), APP_NAME, MB_OK);
+    return 1;
+  }
+
   // show gui
   gui_show();
 
   // load default config
   config_load("freepiano.cfg");
 
+  // recover recording lost in last session, otherwise play songs given on command line
+  if (song_recover() == 0)
+    MessageBox(gui_get_window(), lang_load_string(IDS_SONG_RECOVERED), APP_NAME, MB_OK);
+  else
+    batch_start_playlist();
+
   // check for update
 #ifndef _DEBUG
   update_check_async();
@@ -72,6 +92,9 @@ int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmd
 
   config_save("freepiano.cfg");
 
+  // close song, unsaved recording is not kept after a normal exit
+  song_shutdown();
+
   // shutdown keyboard
   keyboard_shutdown();
 
@@ -33,12 +33,14 @@ static thread_lock_t midi_output_lock;
 static byte note_states[16][128] = {0};
 static byte note_pressure[16][128] = {0};
 
-// auto generated keyup events
-struct midi_keyup_t {
-  byte midi_display_key;
-  key_bind_t map;
-};
-static std::multimap<byte, midi_keyup_t> key_up_map;
+// output muted
+static bool midi_output_muted = false;
+
+// receives muted output
+static midi_output_callback *midi_output_capture = NULL;
+
+// receives output events instead of device and plugin
+static midi_output_callback *midi_output_trace = NULL;
 
 // get key status
 byte midi_get_note_status(byte ch, byte note) {
@@ -117,7 +119,7 @@ static void CALLBACK midi_input_callback(HMIDIIN hMidiIn, UINT wMsg, DWORD_PTR d
       }
     }
 
-    song_send_event(a, b, c, d, true);
+    song_queue_event(a, b, c, d);
   }
 }
 
@@ -210,15 +212,22 @@ void midi_enum_output(midi_enum_callback &callback) {
   }
 }
 
-// midi reset
-void midi_reset() {
-  // all notes off
+// release holding notes
+void midi_release_notes() {
   for (int ch = 0; ch < 16; ch++) {
     for (int note = 0; note < 128; note++) {
       if (note_states[ch][note])
         midi_output_event(SM_MIDI_NOTEOFF | ch, note, 0, 0);
     }
+  }
+}
 
+// midi reset
+void midi_reset() {
+  // all notes off
+  midi_release_notes();
+
+  for (int ch = 0; ch < 16; ch++) {
     for (int i = 0; i < 128; i++)
       if (config_get_controller(SM_OUTPUT_0 + ch, i) < 128)
         midi_output_event(SM_MIDI_CONTROLLER | ch, i, config_get_controller(SM_OUTPUT_0 + ch, i), 0);
@@ -228,6 +237,38 @@ void midi_reset() {
   }
 }
 
+// mute output
+void midi_set_output_mute(bool mute) {
+  midi_output_muted = mute;
+}
+
+// capture muted output
+void midi_set_output_capture(midi_output_callback *callback) {
+  midi_output_capture = callback;
+}
+
+// trace output events instead of sending them
+void midi_set_output_trace(midi_output_callback *callback) {
+  midi_output_trace = callback;
+}
+
+// resend controllers, programs and holding notes to output
+void midi_resend_state() {
+  for (int ch = 0; ch < 16; ch++) {
+    for (int i = 0; i < 128; i++)
+      if (config_get_controller(SM_OUTPUT_0 + ch, i) < 128)
+        midi_output_event(SM_MIDI_CONTROLLER | ch, i, config_get_controller(SM_OUTPUT_0 + ch, i), 0);
+
+    if (config_get_program(SM_OUTPUT_0 + ch) < 128)
+      midi_output_event(SM_MIDI_PROGRAM | ch, config_get_program(SM_OUTPUT_0 + ch), 0, 0);
+
+    for (int note = 0; note < 128; note++) {
+      if (note_states[ch][note])
+        midi_output_event(SM_MIDI_NOTEON | ch, note, note_states[ch][note], 0);
+    }
+  }
+}
+
 // wrap value
 static int wrap_value(int value, int min_v, int max_v) {
   if (value < min_v) value = max_v;
@@ -289,9 +330,22 @@ void midi_output_event(byte a, byte b, byte c, byte d) {
   fprintf(stdout, "MIDI OUT: %04x %02x %02x %02x %02x\n", GetTickCount(), a, b, c, d);
 #endif
 
+  // state only
+  if (midi_output_muted) {
+    if (midi_output_capture)
+      (*midi_output_capture)(a, b, c, d);
+    return;
+  }
+
+  // headless trace
+  if (midi_output_trace) {
+    (*midi_output_trace)(a, b, c, d);
+    return;
+  }
+
   // send midi event to vst plugin
   if (vsti_is_instrument_loaded()) {
-    vsti_send_midi_event(a, b, c, d);
+    vsti_send_midi_event(a, b, c, d, song_get_event_offset());
   }
   // send event to output device
   else {
@@ -4,6 +4,10 @@ struct midi_enum_callback {
   virtual void operator () (const char *value) = 0;
 };
 
+struct midi_output_callback {
+  virtual void operator () (byte a, byte b, byte c, byte d) = 0;
+};
+
 // open output device
 int midi_open_output(const char *name);
 
@@ -28,6 +32,21 @@ void midi_enum_output(midi_enum_callback &callbcak);
 // rest midi
 void midi_reset();
 
+// release holding notes only
+void midi_release_notes();
+
+// mute output, note and controller states are still tracked
+void midi_set_output_mute(bool mute);
+
+// receive events while output is muted
+void midi_set_output_capture(midi_output_callback *callback);
+
+// send output events to a callback instead of device or plugin
+void midi_set_output_trace(midi_output_callback *callback);
+
+// resend controllers, programs and holding notes to output
+void midi_resend_state();
+
 // get key status
 byte midi_get_note_status(byte ch, byte note);
 
@@ -243,7 +243,7 @@ static ASIOTime* callback_buffer_switch_timeinfo(ASIOTime *timeInfo, long index,
     memset(output_buffer[1], 0, buffSize * sizeof(float));
   } else   {
     // update
-    song_update(1000.0 * (double)driver_info.preferredSize / (double)driver_info.sampleRate);
+    song_update(driver_info.preferredSize, (uint)driver_info.sampleRate);
 
     // call vsti process func
     vsti_update_config((float)driver_info.sampleRate, driver_info.preferredSize);
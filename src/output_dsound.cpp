@@ -100,7 +100,7 @@ static DWORD __stdcall dsound_play_thread(void *param) {
         memset(output_buffer[1], 0, samples * sizeof(float));
       } else   {
         // update
-        song_update(1000.0 * (double)samples / (double)format.nSamplesPerSec);
+        song_update(samples, format.nSamplesPerSec);
 
         // call vsti process func
         vsti_update_config((float)format.nSamplesPerSec, 4096);
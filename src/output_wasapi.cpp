@@ -88,7 +88,7 @@ static DWORD __stdcall wasapi_play_thread(void *param) {
             memset(output_buffer[1], 0, numFramesProcess * sizeof(float));
           } else   {
             // update song
-            song_update(1000.0 * (double)32 / (double)pwfx->nSamplesPerSec);
+            song_update(numFramesProcess, pwfx->nSamplesPerSec);
 
             // update effect
             vsti_update_config((float)pwfx->nSamplesPerSec, 32);
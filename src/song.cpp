@@ -10,13 +10,27 @@
 #include "utilities.h"
 
 #include <dinput.h>
+#include <io.h>
 #include <Shlwapi.h>
 #include <zlib.h>
-#include <list>
 #include <vector>
+#include <string>
+#include <algorithm>
 
 
+// song time is stored as integer ticks
+#define SONG_TICKS_PER_MS         10
+
 struct song_event_t {
+  uint time;
+  byte a;
+  byte b;
+  byte c;
+  byte d;
+};
+
+// event layout used by version 1.8 and before
+struct song_event_legacy_t {
   double time;
   byte a;
   byte b;
@@ -24,42 +38,453 @@ struct song_event_t {
   byte d;
 };
 
-// record buffer (1M events should be enough.)
-static song_event_t song_event_buffer[1024 * 1024];
+// convert milliseconds to ticks
+static inline uint song_ms_to_tick(double ms) {
+  if (ms <= 0)
+    return 0;
+  if (ms >= (double)0xffffffff / SONG_TICKS_PER_MS)
+    return 0xffffffff;
+  return (uint)(ms * SONG_TICKS_PER_MS + 0.5);
+}
+
+// convert ticks to milliseconds
+static inline double song_tick_to_ms(uint tick) {
+  return (double)tick / SONG_TICKS_PER_MS;
+}
+
+// -----------------------------------------------------------------------------------------
+// event store
+// -----------------------------------------------------------------------------------------
+// events are kept in fixed size chunks allocated on demand, a chunk never moves once
+// allocated, so a playback cursor stays valid while new events are appended. stores
+// take chunks from a few spare ones first, the spares are refilled off the audio thread.
+// recording only takes spares and drops events when none is left, it never allocates.
+#define SONG_CHUNK_SHIFT          16
+#define SONG_CHUNK_SIZE           (1 << SONG_CHUNK_SHIFT)
+#define SONG_CHUNK_MASK           (SONG_CHUNK_SIZE - 1)
+#define SONG_CHUNK_MAX            4096
+#define SONG_CHUNK_SPARE          2
+
+// the chunk index is allocated once, so stores are exchanged by pointer
+struct song_event_store_t {
+  song_event_t **chunks;
+  uint chunk_count;
+  volatile uint size;
+
+  song_event_store_t() : chunks(new song_event_t*[SONG_CHUNK_MAX]), chunk_count(0), size(0) {}
+};
+
+struct song_event_cursor_t {
+  song_event_t *event;
+  song_event_t *chunk_end;
+  uint index;
+};
+
+// max events a store can hold
+static const uint song_event_capacity = SONG_CHUNK_SIZE * SONG_CHUNK_MAX;
+
+// get event by index
+static inline song_event_t* event_store_at(song_event_store_t &store, uint index) {
+  return store.chunks[index >> SONG_CHUNK_SHIFT] + (index & SONG_CHUNK_MASK);
+}
+
+// spare chunks, a slot is NULL when taken
+static song_event_t * volatile song_chunk_spare[SONG_CHUNK_SPARE];
+
+// take a spare chunk, returns NULL when none is left
+static song_event_t* event_chunk_take() {
+  for (int i = 0; i < SONG_CHUNK_SPARE; i++) {
+    song_event_t *chunk = (song_event_t *)InterlockedExchangePointer((void * volatile *)&song_chunk_spare[i], NULL);
+    if (chunk)
+      return chunk;
+  }
+  return NULL;
+}
+
+// take a spare chunk or allocate one when none is left, never called by the audio thread
+static song_event_t* event_chunk_alloc() {
+  song_event_t *chunk = event_chunk_take();
+
+  if (chunk == NULL)
+    chunk = new song_event_t[SONG_CHUNK_SIZE];
+
+  return chunk;
+}
+
+// keep chunk as a spare or free it
+static void event_chunk_free(song_event_t *chunk) {
+  for (int i = 0; i < SONG_CHUNK_SPARE && chunk; i++) {
+    if (InterlockedCompareExchangePointer((void * volatile *)&song_chunk_spare[i], chunk, NULL) == NULL)
+      chunk = NULL;
+  }
+  delete[] chunk;
+}
+
+// fill taken spare slots, never called by the audio thread
+static void event_chunk_refill() {
+  for (int i = 0; i < SONG_CHUNK_SPARE; i++) {
+    if (song_chunk_spare[i] == NULL)
+      event_chunk_free(new song_event_t[SONG_CHUNK_SIZE]);
+  }
+}
+
+// make sure the chunk holding the next event exists, only from spares when spare is set
+static bool event_store_grow(song_event_store_t &store, bool spare) {
+  uint chunk = store.size >> SONG_CHUNK_SHIFT;
+
+  if (chunk >= SONG_CHUNK_MAX)
+    return false;
+
+  if (chunk >= store.chunk_count) {
+    song_event_t *events = spare ? event_chunk_take() : event_chunk_alloc();
+
+    if (events == NULL)
+      return false;
+
+    store.chunks[chunk] = events;
+    store.chunk_count = chunk + 1;
+  }
+  return true;
+}
+
+// reset store, keep allocated chunks for reuse
+static void event_store_reset(song_event_store_t &store) {
+  store.size = 0;
+  event_store_grow(store, true);
+}
+
+// release all chunks
+static void event_store_free(song_event_store_t &store) {
+  for (uint i = 0; i < store.chunk_count; i++) {
+    event_chunk_free(store.chunks[i]);
+    store.chunks[i] = NULL;
+  }
+  store.chunk_count = 0;
+  store.size = 0;
+}
+
+// get free space in current chunk, the caller fills it and calls event_store_commit
+static song_event_t* event_store_tail(song_event_store_t &store, uint *count) {
+  if (store.size >= song_event_capacity || !event_store_grow(store, false)) {
+    *count = 0;
+    return NULL;
+  }
+
+  *count = SONG_CHUNK_SIZE - (store.size & SONG_CHUNK_MASK);
+  return event_store_at(store, store.size);
+}
+
+// commit events written to tail, next chunk is allocated here when current one
+// is full, so readers never see a missing chunk below the store size.
+static void event_store_commit(song_event_store_t &store, uint count) {
+  // publish events after they are written, the store may be read by playback while loading
+  InterlockedExchange((volatile LONG *)&store.size, store.size + count);
+
+  if (store.size < song_event_capacity)
+    event_store_grow(store, false);
+}
+
+// append an event
+static song_event_t* event_store_append(song_event_store_t &store) {
+  uint count;
+  song_event_t *e = event_store_tail(store, &count);
+
+  if (e)
+    event_store_commit(store, 1);
+
+  return e;
+}
+
+// append a recorded event, called by the audio thread. returns false when the store
+// is full or no spare chunk is left.
+static bool event_store_record(song_event_store_t &store, const song_event_t &e) {
+  if (store.size >= song_event_capacity || !event_store_grow(store, true))
+    return false;
+
+  *event_store_at(store, store.size) = e;
+  InterlockedExchange((volatile LONG *)&store.size, store.size + 1);
+  return true;
+}
+
+// move cursor to event
+static inline void event_cursor_seek(song_event_cursor_t &cursor, song_event_store_t &store, uint index) {
+  uint chunk = index >> SONG_CHUNK_SHIFT;
+
+  cursor.index = index;
+  cursor.event = NULL;
+  cursor.chunk_end = NULL;
+
+  if (chunk < store.chunk_count) {
+    cursor.event = store.chunks[chunk] + (index & SONG_CHUNK_MASK);
+    cursor.chunk_end = store.chunks[chunk] + SONG_CHUNK_SIZE;
+  }
+}
+
+// move cursor to next event, returns new index
+static inline uint event_cursor_next(song_event_cursor_t &cursor, song_event_store_t &store) {
+  if (++cursor.event == cursor.chunk_end)
+    event_cursor_seek(cursor, store, cursor.index + 1);
+  else
+    cursor.index++;
+
+  return cursor.index;
+}
+
+// -----------------------------------------------------------------------------------------
+// tracks
+// -----------------------------------------------------------------------------------------
+// a song has up to SONG_TRACK_MAX event tracks, track 0 is the base recording and the
+// others are overdubs. each track has its own cursor and playback merges them with a
+// heap ordered by the next event time, so only tracks with due events are touched.
+#define SONG_TRACK_MAX            8
+
+struct song_track_t {
+  song_event_store_t events;
+  song_event_cursor_t position;
+};
+
+static song_track_t song_tracks[SONG_TRACK_MAX];
+static uint song_track_count = 0;
+static uint song_record_track = 0;
+
+// base track, filled by the background loader
+static song_event_store_t &song_events = song_tracks[0].events;
+
+// play position, tracks ordered by next event
+static uint play_heap[SONG_TRACK_MAX];
+static uint play_heap_size = 0;
+
+// base track ran out of events while still loading
+static bool play_base_waiting = false;
 
-// record or play position
-static song_event_t *play_position = NULL;
-static song_event_t *record_position = NULL;
-static song_event_t *song_end = NULL;
+static bool song_playing = false;
+static bool song_recording = false;
+static volatile LONG song_record_overflow = 0;   // recorded events dropped without a spare chunk
+static bool song_opened = false;
+static bool song_realtime = false;      // events are played by song_update
 static double song_timer = 0;
+static uint song_tick = 0;
 static double song_play_speed = 1;
 static double song_auto_pedal_timer = 0;
 static double song_clock = 0;
 
+// song timer and clock are derived from samples counted since an origin instead of
+// summing block lengths, so they don't drift from the audio position in long sessions.
+// the origin moves to the current value when it was set elsewhere (seek, loop, record)
+// or when sample rate or play speed change.
+struct song_sample_clock_t {
+  LONGLONG samples;
+  double origin;
+  double scale;
+  double value;
+};
+
+static song_sample_clock_t song_timer_samples = {0};
+static song_sample_clock_t song_clock_samples = {0};
+
+// timer and clock published for readers without the song lock
+struct song_clock_seqlock_t {
+  volatile LONG sequence;
+  double timer;
+  double clock;
+};
+
+static song_clock_seqlock_t song_published_clock = {0};
+static void song_clock_publish();
+
+// song is loading in background
+static volatile bool song_loading = false;
+static uint song_loading_length = 0;
+
 static song_info_t song_info;
 
 // song thread lock
 static thread_lock_t song_lock;
 
 // current version
-static uint current_version = 0x01080000;
+static uint current_version = 0x010c0000;
+
+// track takes part in playback, the track being overdubbed is not played
+static inline bool play_track_enabled(uint track) {
+  return track < song_track_count && !(song_recording && track == song_record_track);
+}
+
+// track cursor points to a loaded event
+static inline bool play_track_ready(uint track) {
+  song_track_t &t = song_tracks[track];
+
+  if (t.position.index >= t.events.size)
+    return false;
+
+  // chunk was not loaded when cursor moved
+  if (t.position.event == NULL)
+    event_cursor_seek(t.position, t.events, t.position.index);
+
+  return t.position.event != NULL;
+}
+
+// heap order: earlier event first, lower track first on ties
+static inline bool play_heap_before(uint a, uint b) {
+  uint ta = song_tracks[a].position.event->time;
+  uint tb = song_tracks[b].position.event->time;
+  return ta < tb || (ta == tb && a < b);
+}
+
+// move heap entry down to its place
+static void play_heap_down(uint i) {
+  for (;;) {
+    uint first = i;
+    uint left = i * 2 + 1;
+    uint right = left + 1;
+
+    if (left < play_heap_size && play_heap_before(play_heap[left], play_heap[first]))
+      first = left;
+    if (right < play_heap_size && play_heap_before(play_heap[right], play_heap[first]))
+      first = right;
+
+    if (first == i)
+      break;
+
+    uint temp = play_heap[i];
+    play_heap[i] = play_heap[first];
+    play_heap[first] = temp;
+    i = first;
+  }
+}
+
+// add track to play heap
+static void play_heap_push(uint track) {
+  uint i = play_heap_size++;
+  play_heap[i] = track;
+
+  while (i > 0) {
+    uint parent = (i - 1) / 2;
+
+    if (!play_heap_before(play_heap[i], play_heap[parent]))
+      break;
+
+    uint temp = play_heap[i];
+    play_heap[i] = play_heap[parent];
+    play_heap[parent] = temp;
+    i = parent;
+  }
+}
+
+// add a track or park it while its events are loading
+static void play_track_insert(uint track) {
+  if (play_track_ready(track))
+    play_heap_push(track);
+  else if (track == 0 && song_loading)
+    play_base_waiting = true;
+}
+
+// move play position, index holds an event index for every track
+static void play_position_seek(const uint *index) {
+  play_heap_size = 0;
+  play_base_waiting = false;
+
+  for (uint i = 0; i < SONG_TRACK_MAX; i++) {
+    song_track_t &t = song_tracks[i];
+    event_cursor_seek(t.position, t.events, index ? index[i] : 0);
+
+    if (play_track_enabled(i))
+      play_track_insert(i);
+  }
+}
+
+// get current event indices of all tracks
+static void play_position_get(uint *index) {
+  for (uint i = 0; i < SONG_TRACK_MAX; i++)
+    index[i] = song_tracks[i].position.index;
+}
+
+// next event to play, NULL when no event is available
+static song_event_t* play_position_peek() {
+  if (play_base_waiting) {
+    // read loading flag first, every event is published before it is cleared
+    bool loading = song_loading;
+
+    if (play_track_ready(0)) {
+      play_base_waiting = false;
+      play_heap_push(0);
+    } else if (!loading) {
+      play_base_waiting = false;
+    }
+  }
+
+  if (play_heap_size == 0)
+    return NULL;
+
+  return song_tracks[play_heap[0]].position.event;
+}
+
+// advance past the event returned by play_position_peek
+static void play_position_next() {
+  uint track = play_heap[0];
+  song_track_t &t = song_tracks[track];
+
+  event_cursor_next(t.position, t.events);
+
+  if (play_track_ready(track)) {
+    play_heap_down(0);
+  } else {
+    play_heap[0] = play_heap[--play_heap_size];
+    play_heap_down(0);
+    play_track_insert(track);
+  }
+}
+
+// no more events to play
+static bool play_position_end() {
+  return play_heap_size == 0 && !play_base_waiting;
+}
+
+// number of tracks still playing
+static uint play_position_tracks() {
+  return play_heap_size + (play_base_waiting ? 1 : 0);
+}
 
 // -----------------------------------------------------------------------------------------
 // SYNC and DELAY event
 // -----------------------------------------------------------------------------------------
+// pending events live in fixed pools, nothing is allocated while updating. delay events
+// are kept in a min heap ordered by due time, sync events in one fifo per flag value, so
+// each update only touches the events that fire.
+#define SYNC_EVENT_MAX            1024
+#define SYNC_BUCKET_MAX           8
+#define DELAY_EVENT_MAX           1024
+
 struct sync_event_t {
-  uint flag;
   uint id;
+  uint next;
   key_bind_t map;
 };
 
+struct sync_bucket_t {
+  uint flag;
+  uint head;
+  uint tail;
+};
+
 struct delay_event_t {
-  double timer;
+  double time;
+  uint sequence;
   key_bind_t map;
 };
 
-static std::list<sync_event_t> sync_events;
-static std::list<delay_event_t> delay_events;
+// sync event pool, events are linked by index
+static const uint sync_event_none = (uint)-1;
+static sync_event_t sync_events[SYNC_EVENT_MAX];
+static sync_bucket_t sync_buckets[SYNC_BUCKET_MAX];
+static uint sync_bucket_count = 0;
+static uint sync_free = sync_event_none;
+static uint sync_used = 0;
+
+// delay event heap
+static delay_event_t delay_events[DELAY_EVENT_MAX];
+static uint delay_event_count = 0;
+static uint delay_sequence = 0;
+static double delay_clock = 0;
 
 // sync trigger
 static uint sync_trigger = 0;
@@ -72,7 +497,9 @@ static const double fixed_smooth_timer = 2;
 // reset sync events
 static void sync_event_reset() {
   thread_lock lock(song_lock);
-  sync_events.clear();
+  sync_bucket_count = 0;
+  sync_free = sync_event_none;
+  sync_used = 0;
   sync_trigger = 0;
   sync_id = 0;
 }
@@ -81,14 +508,54 @@ static void sync_event_reset() {
 static void sync_event_add(uint flag, byte a, byte b, byte c, byte d) {
   thread_lock lock(song_lock);
 
-  sync_event_t e;
-  e.flag = flag;
+  // find bucket
+  sync_bucket_t *bucket = NULL;
+  for (uint i = 0; i < sync_bucket_count; i++) {
+    if (sync_buckets[i].flag == flag) {
+      bucket = &sync_buckets[i];
+      break;
+    }
+  }
+
+  if (bucket == NULL && sync_bucket_count < SYNC_BUCKET_MAX) {
+    bucket = &sync_buckets[sync_bucket_count++];
+    bucket->flag = flag;
+    bucket->head = sync_event_none;
+    bucket->tail = sync_event_none;
+  }
+
+  // allocate event from pool
+  uint index = sync_event_none;
+  if (sync_free != sync_event_none) {
+    index = sync_free;
+    sync_free = sync_events[index].next;
+  } else if (sync_used < SYNC_EVENT_MAX) {
+    index = sync_used++;
+  }
+
+  // out of space, output now
+  if (bucket == NULL || index == sync_event_none) {
+    if (index != sync_event_none) {
+      sync_events[index].next = sync_free;
+      sync_free = index;
+    }
+    song_output_event(a, b, c, d);
+    return;
+  }
+
+  sync_event_t &e = sync_events[index];
   e.id = sync_id;
+  e.next = sync_event_none;
   e.map.a = a;
   e.map.b = b;
   e.map.c = c;
   e.map.d = d;
-  sync_events.push_back(e);
+
+  if (bucket->tail != sync_event_none)
+    sync_events[bucket->tail].next = index;
+  else
+    bucket->head = index;
+  bucket->tail = index;
 }
 
 // update sync events
@@ -96,14 +563,32 @@ static void sync_event_update(double time) {
   thread_lock lock(song_lock);
 
   // events to output
-  std::vector<key_bind_t> output_events;
+  uint output_head = sync_event_none;
+  uint output_tail = sync_event_none;
+
+  // find triggered events, events in a bucket are in id order,
+  // so only the newest ones can be added in current sync period.
+  if (sync_trigger) {
+    for (uint i = 0; i < sync_bucket_count; i++) {
+      sync_bucket_t &bucket = sync_buckets[i];
 
-  // find triggered events
-  for (auto it = sync_events.begin(); it != sync_events.end();) {
-    auto e = it; ++it;
-    if (e->id != sync_id && e->flag & sync_trigger) {
-      output_events.push_back(e->map);
-      sync_events.erase(e);
+      if ((bucket.flag & sync_trigger) == 0)
+        continue;
+
+      while (bucket.head != sync_event_none && sync_events[bucket.head].id != sync_id) {
+        uint index = bucket.head;
+        bucket.head = sync_events[index].next;
+
+        if (bucket.head == sync_event_none)
+          bucket.tail = sync_event_none;
+
+        sync_events[index].next = sync_event_none;
+        if (output_tail != sync_event_none)
+          sync_events[output_tail].next = index;
+        else
+          output_head = index;
+        output_tail = index;
+      }
     }
   }
 
@@ -114,55 +599,96 @@ static void sync_event_update(double time) {
   }
 
   // output events
-  if (!output_events.empty()) {
-    for (auto it = output_events.begin(); it != output_events.end(); ++it) {
-      song_output_event(it->a, it->b, it->c, it->d);
-    }
+  while (output_head != sync_event_none) {
+    uint index = output_head;
+    key_bind_t map = sync_events[index].map;
+    output_head = sync_events[index].next;
+
+    // release to pool
+    sync_events[index].next = sync_free;
+    sync_free = index;
+
+    song_output_event(map.a, map.b, map.c, map.d);
   }
 }
 
-// reset sync events
+// delay event is due before another
+static inline bool delay_event_before(const delay_event_t &a, const delay_event_t &b) {
+  if (a.time != b.time)
+    return a.time < b.time;
+  return (int)(a.sequence - b.sequence) < 0;
+}
+
+// reset delay events
 static void delay_event_reset() {
   thread_lock lock(song_lock);
-  delay_events.clear();
+  delay_event_count = 0;
 }
 
 // add delay event
 static void delay_event_add(double timer, byte a, byte b, byte c, byte d) {
   thread_lock lock(song_lock);
 
+  // out of space, output now
+  if (delay_event_count >= DELAY_EVENT_MAX) {
+    song_output_event(a, b, c, d);
+    return;
+  }
+
   delay_event_t e;
-  e.timer = timer;
+  e.time = delay_clock + timer;
+  e.sequence = delay_sequence++;
   e.map.a = a;
   e.map.b = b;
   e.map.c = c;
   e.map.d = d;
-  delay_events.push_back(e);
+
+  // sift up
+  uint i = delay_event_count++;
+  while (i > 0) {
+    uint parent = (i - 1) / 2;
+    if (!delay_event_before(e, delay_events[parent]))
+      break;
+    delay_events[i] = delay_events[parent];
+    i = parent;
+  }
+  delay_events[i] = e;
+}
+
+// remove first delay event
+static void delay_event_pop() {
+  delay_event_t e = delay_events[--delay_event_count];
+
+  // sift down
+  uint i = 0;
+  for (;;) {
+    uint child = i * 2 + 1;
+    if (child >= delay_event_count)
+      break;
+    if (child + 1 < delay_event_count && delay_event_before(delay_events[child + 1], delay_events[child]))
+      child++;
+    if (!delay_event_before(delay_events[child], e))
+      break;
+    delay_events[i] = delay_events[child];
+    i = child;
+  }
+
+  if (delay_event_count)
+    delay_events[i] = e;
 }
 
 // update delay events
 static void delay_event_update(double time) {
   thread_lock lock(song_lock);
 
-  // events should output this time
-  std::vector<key_bind_t> output_events;
-
-  // find triggered events
-  for (auto it = delay_events.begin(); it != delay_events.end();) {
-    auto e = it; ++it;
-    e->timer -= time;
+  delay_clock += time;
 
-    if (e->timer <= 0) {
-      output_events.push_back(e->map);
-      delay_events.erase(e);
-    }
-  }
+  // output due events
+  while (delay_event_count && delay_events[0].time <= delay_clock) {
+    key_bind_t map = delay_events[0].map;
+    delay_event_pop();
 
-  // output events
-  if (!output_events.empty()) {
-    for (auto it = output_events.begin(); it != output_events.end(); ++it) {
-      song_output_event(it->a, it->b, it->c, it->d);
-    }
+    song_output_event(map.a, map.b, map.c, map.d);
   }
 }
 
@@ -175,18 +701,32 @@ static inline byte translate_channel(byte ch) {
 }
 
 static inline byte translate_note(byte ch, byte note) {
+  config_read_t read;
+  const key_translate_t *lut = config_get_key_translate();
+
+  if (ch < 16 && note < 128)
+    return lut->note[ch][note];
+
+  // channels without settings are not translated
   int value = note;
-  value += config_get_key_octshift(ch) * 12;
-  value += config_get_key_transpose(ch);
+  if (ch < 16) {
+    value += lut->shift[ch];
 
-  if (config_get_follow_key(ch))
-    value += config_get_key_signature();
+    if (lut->follow_key[ch])
+      value += lut->key_signature;
+  }
 
   return clamp_value(value, 0, 127);
 }
 
 static inline byte translate_pressure(byte ch, byte pressure) {
-  return clamp_value((int)pressure * config_get_key_velocity(ch) / 127, 0, 127);
+  config_read_t read;
+  const key_translate_t *lut = config_get_key_translate();
+
+  if (ch < 16 && pressure < 128)
+    return lut->velocity[ch][pressure];
+
+  return clamp_value((int)pressure * (ch < 16 ? lut->key_velocity[ch] : 127) / 127, 0, 127);
 }
 
 static inline int default_value(int v, int dv = 0) {
@@ -296,6 +836,38 @@ static void pitch_update(double time) {
 // add event
 static void song_add_event(double time, byte a, byte b, byte c, byte d);
 
+// clear seek index
+static void song_snapshot_clear();
+
+// stop or wait background loader
+static void song_loader_stop();
+static void song_loader_wait();
+
+// sample offset of current event in audio block
+static uint song_event_offset = 0;
+
+// loop region, wrapped by song_update
+static bool song_loop_enabled = false;
+static uint song_loop_start = 0;
+static uint song_loop_end = 0;
+static void song_loop_clear();
+static void song_loop_wrap();
+
+// close song without stopping the playlist
+static void song_close_file();
+
+// playlist, next song takes over at the end of current one
+static bool song_playlist_swap();
+static void song_playlist_stopped();
+
+// delay of live input event in current block (ms)
+static double song_record_delay = 0;
+
+// get sample offset of current event
+uint song_get_event_offset() {
+  return song_event_offset;
+}
+
 // dynamic mapping
 static byte keyboard_map_key_code = 0;
 static byte keyboard_map_key_type = 0;
@@ -304,6 +876,218 @@ static byte keyboard_label_key_size = 0;
 static char keyboard_label_text[256];
 static byte keyboard_color_key_code = 0;
 
+// -----------------------------------------------------------------------------------------
+// prepared settings
+// -----------------------------------------------------------------------------------------
+// setting groups restored by playback are prepared by a worker thread. the audio thread
+// takes a prepared object by pointer, installs it and hands it back holding the groups it
+// replaced, the worker frees them and prepares the state again for the next time.
+
+struct song_prepared_t {
+  config_state_t *state;                    // source, set with worker lock held
+  config_prepared_t * volatile ready;       // prepared from state, taken by playback
+  config_prepared_t * volatile used;        // installed, holds replaced groups
+};
+
+static thread_lock_t song_worker_lock;
+static HANDLE song_worker_thread = NULL;
+static HANDLE song_worker_wake = NULL;
+
+static song_prepared_t song_loop_config = {0};
+
+static void song_worker_service();
+
+// worker thread
+static DWORD __stdcall song_worker_proc(void *param) {
+  for (;;) {
+    WaitForSingleObject(song_worker_wake, INFINITE);
+    song_worker_service();
+  }
+
+  return 0;
+}
+
+// start worker thread
+static void song_worker_start() {
+  if (song_worker_wake == NULL)
+    song_worker_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  if (song_worker_thread == NULL && song_worker_wake)
+    song_worker_thread = CreateThread(NULL, 0, &song_worker_proc, NULL, NULL, NULL);
+}
+
+// wake worker, may be called by the audio thread
+static void song_worker_signal() {
+  if (song_worker_wake)
+    SetEvent(song_worker_wake);
+}
+
+// free used groups and prepare the state again, worker lock must be held
+static void song_prepared_service(song_prepared_t &p) {
+  config_prepared_t *used = (config_prepared_t*)InterlockedExchangePointer((void* volatile*)&p.used, NULL);
+  config_free_prepared(used);
+
+  if (p.state && p.ready == NULL)
+    InterlockedExchangePointer((void* volatile*)&p.ready, config_prepare_state(p.state));
+}
+
+// change source state, the previous one is no longer prepared. never called by the audio thread
+static void song_prepared_set(song_prepared_t &p, config_state_t *state) {
+  thread_lock lock(song_worker_lock);
+
+  config_free_prepared((config_prepared_t*)InterlockedExchangePointer((void* volatile*)&p.ready, NULL));
+  p.state = state;
+  song_prepared_service(p);
+
+  if (state)
+    song_worker_start();
+}
+
+// install prepared groups, returns false when none is ready
+static bool song_prepared_install(song_prepared_t &p) {
+  config_prepared_t *prepared = (config_prepared_t*)InterlockedExchangePointer((void* volatile*)&p.ready, NULL);
+
+  if (prepared == NULL)
+    return false;
+
+  config_install_prepared(prepared);
+  InterlockedExchangePointer((void* volatile*)&p.used, prepared);
+  song_worker_signal();
+  return true;
+}
+
+// -----------------------------------------------------------------------------------------
+// setting snapshots
+// -----------------------------------------------------------------------------------------
+// setting snapshots are decoded when tracks are loaded or recorded, before their events
+// are visible to playback, and their groups are prepared right away. the header event
+// keeps the index of the decoded state in c and d, playback skips the payload and
+// installs the prepared groups by pointer. silent replays restore the decoded state.
+#define SONG_SETTINGS_MAX         1024
+#define SONG_SETTINGS_SIZE_MAX    (16 * 1024 * 1024)
+
+struct song_settings_t {
+  song_prepared_t states[SONG_SETTINGS_MAX];
+  volatile long count;
+};
+
+// decoded states of current song, and of next song or the one replaced by a swap
+static song_settings_t song_settings_tables[2];
+static song_settings_t *song_settings = &song_settings_tables[0];
+static song_settings_t *song_next_settings = &song_settings_tables[1];
+
+// state of a track being scanned, follows payloads the way playback does
+struct song_settings_scan_t {
+  song_settings_t *settings;
+  bool header;
+  uint words;
+  uint size;
+  long slot;
+  std::vector<byte> data;
+
+  song_settings_scan_t(song_settings_t *settings)
+    : settings(settings), header(false), words(0), size(0), slot(-1) {}
+};
+
+// words used by a payload of size bytes
+static uint song_settings_words(uint size) {
+  return size / 4 + (size % 4 ? 1 : 0);
+}
+
+// free decoded states, nothing may play events of the table
+static void song_settings_clear(song_settings_t *settings) {
+  for (long i = 0; i < settings->count; i++) {
+    config_state_t *state = settings->states[i].state;
+    song_prepared_set(settings->states[i], NULL);
+    config_free_state(state);
+  }
+  settings->count = 0;
+}
+
+// reserve a state slot, returns -1 when table is full
+static long song_settings_reserve(song_settings_t *settings) {
+  long slot = InterlockedIncrement(&settings->count) - 1;
+
+  if (slot >= SONG_SETTINGS_MAX) {
+    InterlockedDecrement(&settings->count);
+    return -1;
+  }
+
+  song_prepared_set(settings->states[slot], NULL);
+  return slot;
+}
+
+// store decoded state and prepare its groups
+static void song_settings_store(song_settings_t *settings, long slot, config_state_t *state) {
+  if (slot < 0)
+    config_free_state(state);
+  else
+    song_prepared_set(settings->states[slot], state);
+}
+
+// scan events before they are appended, setting headers get the index of their state
+static void song_settings_scan(song_settings_scan_t &scan, song_event_t *events, uint count) {
+  for (uint i = 0; i < count; i++) {
+    song_event_t &e = events[i];
+
+    if (scan.header) {
+      scan.header = false;
+      scan.size = (e.a << 24) | (e.b << 16) | (e.c << 8) | e.d;
+      scan.words = song_settings_words(scan.size);
+      scan.data.clear();
+
+      // oversized payload is skipped and never decoded
+      if (scan.size > SONG_SETTINGS_SIZE_MAX)
+        scan.slot = -1;
+    } else if (scan.words) {
+      // payload of labels, key maps and colors is not collected
+      if (scan.slot >= 0 && scan.size) {
+        byte data[4] = { e.a, e.b, e.c, e.d };
+        for (int j = 0; j < 4 && scan.data.size() < scan.size; j++)
+          scan.data.push_back(data[j]);
+      }
+
+      scan.words--;
+    } else if (e.a == SM_SYSTEM) {
+      switch (e.b) {
+       case SMS_KEY_MAP:
+       case SMS_KEY_COLOR:
+         scan.words = e.c ? 1 : 0;
+         scan.size = 0;
+         break;
+
+       case SMS_KEY_LABEL:
+         scan.words = song_settings_words(e.d);
+         scan.size = 0;
+         break;
+
+       case SMS_SETTINGS:
+         scan.header = true;
+         scan.slot = song_settings_reserve(scan.settings);
+         e.c = (scan.slot + 1) >> 8;
+         e.d = (scan.slot + 1);
+         break;
+      }
+      continue;
+    } else {
+      continue;
+    }
+
+    // payload complete, decode it
+    if (scan.words == 0 && scan.size && scan.slot >= 0) {
+      song_settings_store(scan.settings, scan.slot, scan.data.empty() ? NULL :
+                          config_decode_settings(&scan.data[0], scan.data.size()));
+      scan.slot = -1;
+      scan.data.clear();
+    }
+  }
+}
+
+// setting snapshot being played, the header holds its index, the first event its size
+static bool song_settings_header = false;
+static uint song_settings_index = 0;
+static uint song_settings_size = 0;
+
 // keyboard event map
 static void keyboard_event_map(int code, int type) {
   keyboard_map_key_code = code;
@@ -322,17 +1106,41 @@ static void keyboard_event_color(int code, int length) {
   keyboard_color_key_code = code;
 }
 
-// event message
-void song_send_event(byte a, byte b, byte c, byte d, bool record) {
-  thread_lock lock(song_lock);
+// skip setting snapshot payload, its decoded state is applied at once at the end
+static void song_event_settings(byte a, byte b, byte c, byte d) {
+  if (song_settings_header) {
+    song_settings_header = false;
+    song_settings_size = song_settings_words((a << 24) | (b << 16) | (c << 8) | d);
+  } else {
+    song_settings_size--;
+  }
+
+  if (song_settings_size == 0 && song_settings_index > 0 && song_settings_index <= (uint)song_settings->count) {
+    song_prepared_t &p = song_settings->states[song_settings_index - 1];
+
+    // playback only installs prepared groups, replays may restore the state
+    if (song_realtime)
+      song_prepared_install(p);
+    else if (p.state)
+      config_restore_state(p.state);
+  }
+}
 
+// process event message
+static void song_process_event(byte a, byte b, byte c, byte d, bool record) {
   // record event
   if (record) {
     // HACK: don't record playback control commands
     if (a != SM_PLAY &&
         a != SM_RECORD &&
         a != SM_STOP)
-      song_add_event(song_timer, a, b, c, d);
+      song_add_event(song_timer + song_record_delay, a, b, c, d);
+  }
+
+  // receiving setting snapshot
+  if (song_settings_header || song_settings_size) {
+    song_event_settings(a, b, c, d);
+    return;
   }
 
   // setting a key label
@@ -378,6 +1186,7 @@ void song_send_event(byte a, byte b, byte c, byte d, bool record) {
      case SMS_KEY_MAP:   keyboard_event_map(c, d); break;
      case SMS_KEY_LABEL: keyboard_event_label(c, d); break;
      case SMS_KEY_COLOR: keyboard_event_color(c, d); break;
+     case SMS_SETTINGS:  song_settings_header = true; song_settings_index = (c << 8) | d; break;
     }
     return;
   }
@@ -385,9 +1194,165 @@ void song_send_event(byte a, byte b, byte c, byte d, bool record) {
   song_output_event(a, b, c, d);
 }
 
-static void output_controller(byte a, byte b, byte c, byte d, byte id) {
-  byte ch = b;
-  byte op = c;
+// -----------------------------------------------------------------------------------------
+// input queue
+// -----------------------------------------------------------------------------------------
+// input devices push events to a bounded lock free queue, the audio thread drains it at
+// the start of each update. when updates stop for a while (no output device), or the
+// queue is full, the producer drains it itself under the song lock.
+#define SONG_INPUT_QUEUE_SIZE     1024
+#define SONG_INPUT_QUEUE_MASK     (SONG_INPUT_QUEUE_SIZE - 1)
+
+// drain in place when song is not updated for this time (ms)
+static const DWORD song_input_timeout = 100;
+
+struct song_input_event_t {
+  volatile LONG sequence;
+  LONGLONG time;
+  byte a;
+  byte b;
+  byte c;
+  byte d;
+};
+
+struct song_input_queue_t {
+  song_input_event_t events[SONG_INPUT_QUEUE_SIZE];
+  volatile LONG head;
+  LONG tail;
+  volatile LONG overflow;
+
+  song_input_queue_t() : head(0), tail(0), overflow(0) {
+    for (LONG i = 0; i < SONG_INPUT_QUEUE_SIZE; i++)
+      events[i].sequence = i;
+  }
+};
+
+static song_input_queue_t song_input_queue;
+
+// last update time
+static volatile DWORD song_update_heartbeat = 0;
+
+// performance counter at last update, live input is placed into the next block
+// at the same distance from block start.
+static LONGLONG song_update_counter = 0;
+static LONGLONG song_counter_frequency = 0;
+
+// push event to queue, returns false when queue is full
+static bool song_input_push(byte a, byte b, byte c, byte d) {
+  song_input_queue_t &q = song_input_queue;
+  song_input_event_t *e;
+  LONG pos = q.head;
+
+  for (;;) {
+    e = &q.events[pos & SONG_INPUT_QUEUE_MASK];
+    LONG diff = e->sequence - pos;
+
+    if (diff == 0) {
+      // claim the slot
+      if (InterlockedCompareExchange(&q.head, pos + 1, pos) == pos)
+        break;
+    } else if (diff < 0) {
+      return false;
+    }
+
+    pos = q.head;
+  }
+
+  LARGE_INTEGER time;
+  QueryPerformanceCounter(&time);
+
+  e->time = time.QuadPart;
+  e->a = a;
+  e->b = b;
+  e->c = c;
+  e->d = d;
+
+  // publish the slot to consumer
+  InterlockedExchange(&e->sequence, pos + 1);
+  return true;
+}
+
+// process queued events, song lock must be held.
+// events get a sample offset into current block when samples is not zero.
+static void song_input_drain(uint samples = 0, uint samplerate = 0) {
+  song_input_queue_t &q = song_input_queue;
+
+  for (;;) {
+    song_input_event_t *e = &q.events[q.tail & SONG_INPUT_QUEUE_MASK];
+
+    if (e->sequence != q.tail + 1)
+      break;
+
+    byte a = e->a;
+    byte b = e->b;
+    byte c = e->c;
+    byte d = e->d;
+    LONGLONG time = e->time;
+
+    // release the slot to producers
+    InterlockedExchange(&e->sequence, q.tail + SONG_INPUT_QUEUE_SIZE);
+    q.tail++;
+
+    // delay event by one block
+    if (samples && song_update_counter && time > song_update_counter) {
+      LONGLONG offset = (time - song_update_counter) * samplerate / song_counter_frequency;
+      song_event_offset = offset < samples ? (uint)offset : samples - 1;
+      song_record_delay = 1000.0 * song_event_offset / samplerate;
+    }
+
+    song_process_event(a, b, c, d, true);
+
+    song_event_offset = 0;
+    song_record_delay = 0;
+  }
+}
+
+// queue event from input device
+void song_queue_event(byte a, byte b, byte c, byte d) {
+  bool queued = song_input_push(a, b, c, d);
+
+  if (!queued)
+    InterlockedIncrement(&song_input_queue.overflow);
+
+  // song is not updating or queue is full, drain in place
+  if (!queued || GetTickCount() - song_update_heartbeat > song_input_timeout) {
+    thread_lock lock(song_lock);
+    song_input_drain();
+
+    if (!queued)
+      song_process_event(a, b, c, d, true);
+  }
+}
+
+// event message
+void song_send_event(byte a, byte b, byte c, byte d, bool record) {
+  thread_lock lock(song_lock);
+
+  // keep order with queued input
+  if (record)
+    song_input_drain();
+
+  song_process_event(a, b, c, d, record);
+}
+
+// get queued input events
+uint song_get_input_queue_depth() {
+  return (uint)(song_input_queue.head - song_input_queue.tail);
+}
+
+// get times input queue was full
+uint song_get_input_queue_overflow() {
+  return (uint)song_input_queue.overflow;
+}
+
+// get recorded events dropped because no spare chunk was left
+uint song_get_record_overflow() {
+  return (uint)song_record_overflow;
+}
+
+static void output_controller(byte a, byte b, byte c, byte d, byte id) {
+  byte ch = b;
+  byte op = c;
   int change = (char)d;
   int value = 0;
 
@@ -736,26 +1701,479 @@ void song_output_event(byte a, byte b, byte c, byte d) {
   }
 }
 
+// -----------------------------------------------------------------------------------------
+// recording journal
+// -----------------------------------------------------------------------------------------
+// recorded events are copied to a ring and appended to a journal file by a writer
+// thread, so a take survives a crash. the recording side never waits on the disk, when
+// the ring is full the event is still recorded but missing from the journal. the last
+// SONG_JOURNAL_CONTROL entries are only used to open, close and discard takes, a burst
+// of events can not push them out.
+// an event with time SONG_JOURNAL_TRACK switches the track following events belong to.
+
+#define SONG_JOURNAL_SIZE         8192
+#define SONG_JOURNAL_MASK         (SONG_JOURNAL_SIZE - 1)
+#define SONG_JOURNAL_CONTROL      256
+#define SONG_JOURNAL_TRACK        0xffffffff
+
+// writer wakes up and flushes the file to disk at these intervals (ms)
+static const DWORD song_journal_interval = 100;
+static const DWORD song_journal_sync = 1000;
+
+static const char song_journal_magic[] = "FreePianoJournal";
+static const char song_journal_file[] = "freepiano.fpj";
+
+enum song_journal_op_t {
+  SONG_JOURNAL_EVENT,
+  SONG_JOURNAL_OPEN,
+  SONG_JOURNAL_APPEND,
+  SONG_JOURNAL_CLOSE,
+  SONG_JOURNAL_DISCARD,
+};
+
+struct song_journal_entry_t {
+  uint op;
+  song_event_t event;
+};
+
+struct song_journal_t {
+  song_journal_entry_t entries[SONG_JOURNAL_SIZE];
+  volatile LONG head;
+  volatile LONG tail;
+  volatile LONG dropped;
+
+  song_journal_t() : head(0), tail(0), dropped(0) {}
+};
+
+static song_journal_t song_journal;
+static HANDLE song_journal_thread = NULL;
+
+// current take is journaled
+static bool song_journal_recording = false;
+
+// journal file belongs to current song
+static bool song_journal_owned = false;
+
+// get journal file path
+static void song_journal_path(char *buff, int size) {
+  config_get_media_path(buff, size, song_journal_file);
+}
+
+// push journal entry, song lock must be held
+static void song_journal_push(uint op, const song_event_t *e) {
+  song_journal_t &j = song_journal;
+  LONG pos = j.head;
+  LONG limit = op == SONG_JOURNAL_EVENT ? SONG_JOURNAL_SIZE - SONG_JOURNAL_CONTROL : SONG_JOURNAL_SIZE;
+
+  if (pos - j.tail >= limit) {
+    InterlockedIncrement(&j.dropped);
+    return;
+  }
+
+  song_journal_entry_t &entry = j.entries[pos & SONG_JOURNAL_MASK];
+  entry.op = op;
+  if (e) entry.event = *e;
+
+  // publish the entry to writer
+  InterlockedExchange(&j.head, pos + 1);
+}
+
+// journal writer thread
+static DWORD __stdcall song_journal_proc(void *param) {
+  song_journal_t &j = song_journal;
+  std::vector<song_event_t> batch;
+  FILE *fp = NULL;
+  DWORD sync_time = GetTickCount();
+  bool dirty = false;
+  char path[MAX_PATH];
+
+  song_journal_path(path, sizeof(path));
+
+  for (;;) {
+    Sleep(song_journal_interval);
+
+    // spare chunks taken by recording are replaced here
+    event_chunk_refill();
+
+    LONG head = j.head;
+    LONG tail = j.tail;
+
+    for (; tail != head; tail++) {
+      const song_journal_entry_t &entry = j.entries[tail & SONG_JOURNAL_MASK];
+
+      if (entry.op == SONG_JOURNAL_EVENT) {
+        batch.push_back(entry.event);
+        continue;
+      }
+
+      // write pending events before changing file
+      if (fp && !batch.empty()) {
+        fwrite(&batch[0], sizeof(song_event_t), batch.size(), fp);
+        dirty = true;
+      }
+      batch.clear();
+
+      switch (entry.op) {
+       case SONG_JOURNAL_OPEN:
+       case SONG_JOURNAL_APPEND:
+        if (fp) fclose(fp);
+        fp = NULL;
+
+        if (entry.op == SONG_JOURNAL_APPEND)
+          fp = fopen(path, "r+b");
+
+        if (fp) {
+          fseek(fp, 0, SEEK_END);
+        } else if ((fp = fopen(path, "wb")) != NULL) {
+          uint version = current_version;
+          fwrite(song_journal_magic, sizeof(song_journal_magic), 1, fp);
+          fwrite(&version, sizeof(version), 1, fp);
+        }
+
+        if (fp && entry.op == SONG_JOURNAL_APPEND) {
+          song_event_t marker = entry.event;
+          marker.time = SONG_JOURNAL_TRACK;
+          fwrite(&marker, sizeof(marker), 1, fp);
+        }
+        dirty = true;
+        break;
+
+       case SONG_JOURNAL_CLOSE:
+        if (fp) {
+          fflush(fp);
+          _commit(_fileno(fp));
+          fclose(fp);
+          fp = NULL;
+        }
+        dirty = false;
+        break;
+
+       case SONG_JOURNAL_DISCARD:
+        if (fp) fclose(fp);
+        fp = NULL;
+        DeleteFile(path);
+        dirty = false;
+        break;
+      }
+    }
+
+    if (fp && !batch.empty()) {
+      fwrite(&batch[0], sizeof(song_event_t), batch.size(), fp);
+      dirty = true;
+    }
+    batch.clear();
+
+    // entries are consumed only after they are handed to the file
+    InterlockedExchange(&j.tail, tail);
+
+    if (fp && dirty && GetTickCount() - sync_time >= song_journal_sync) {
+      fflush(fp);
+      _commit(_fileno(fp));
+      sync_time = GetTickCount();
+      dirty = false;
+    }
+  }
+
+  return 0;
+}
+
+// start journaling current take
+static void song_journal_begin() {
+  // recording starts with full spare chunks even without writer thread
+  event_chunk_refill();
+
+  if (song_journal_thread == NULL) {
+    song_journal_thread = CreateThread(NULL, 0, &song_journal_proc, NULL, NULL, NULL);
+
+    if (song_journal_thread == NULL)
+      return;
+  }
+
+  song_event_t marker = { SONG_JOURNAL_TRACK, (byte)song_record_track, 0, 0, 0 };
+
+  song_journal_push(song_record_track ? SONG_JOURNAL_APPEND : SONG_JOURNAL_OPEN, &marker);
+  song_journal_recording = true;
+  song_journal_owned = true;
+}
+
+// add recorded event to journal
+static void song_journal_event(const song_event_t &e) {
+  if (song_journal_recording)
+    song_journal_push(SONG_JOURNAL_EVENT, &e);
+}
+
+// take finished, journal stays until the song is saved or closed
+static void song_journal_end() {
+  if (song_journal_recording) {
+    song_journal_push(SONG_JOURNAL_CLOSE, NULL);
+    song_journal_recording = false;
+  }
+}
+
+// remove journal of current song
+static void song_journal_discard() {
+  song_journal_end();
+
+  if (song_journal_owned) {
+    song_journal_push(SONG_JOURNAL_DISCARD, NULL);
+    song_journal_owned = false;
+  }
+}
+
+// wait writer to finish pending entries
+static void song_journal_flush() {
+  if (song_journal_thread == NULL)
+    return;
+
+  for (int i = 0; i < 50 && song_journal.tail != song_journal.head; i++)
+    Sleep(song_journal_interval / 2);
+}
+
+// -----------------------------------------------------------------------------------------
+// controller thinning
+// -----------------------------------------------------------------------------------------
+// dense controller streams are reduced while recording and by the offline transform with
+// the same rule. playback holds a controller value until the next event, so an event is
+// redundant when it is within the tolerance of the last kept value and the interval since
+// it has not passed. the newest redundant event of a stream is held until a later one
+// replaces it, so every sweep still ends on its exact value. while recording, held events
+// never reach the track or the journal unless they are still the newest one when another
+// event is written.
+
+#define SONG_THIN_STREAMS         65536
+#define SONG_THIN_HELD_MAX        256
+
+enum song_thin_result_t {
+  SONG_THIN_KEEP,
+  SONG_THIN_DROP,
+  SONG_THIN_HOLD,
+};
+
+// thinning parameters, zero disables a rule
+struct song_thin_t {
+  uint interval;              // ticks an event may replace the last kept one
+  int tolerance;              // value change an event may replace the last kept one
+};
+
+// last kept event of a stream
+struct song_thin_state_t {
+  bool active;
+  uint time;
+  int value;
+};
+
+// controller keeps its exact value stream
+static bool song_thin_keep_controller(byte controller) {
+  switch (controller) {
+   case 0: case 32:     // bank select
+   case 6: case 38:     // data entry
+   case 96: case 97:    // data increment
+   case 98: case 99:    // nrpn
+   case 100: case 101:  // rpn
+     return true;
+  }
+
+  // pedal switches and channel mode messages
+  return (controller >= 64 && controller <= 69) || controller >= 120;
+}
+
+// get stream and value of an event that can be thinned
+static bool song_thin_classify(const song_event_t &e, ushort *key, int *value, int *scale) {
+  *scale = 1;
+
+  switch (e.a) {
+   // only absolute values can be thinned
+   case SM_PITCH:
+   case SM_PRESSURE:
+   case SM_MODULATION:
+     if ((e.c & 0x0f) != SM_VALUE_SET || (e.c & SM_VALUE_SYNC))
+       return false;
+     *key = (e.a << 8) | e.b;
+     *value = e.d;
+     return true;
+  }
+
+  switch (e.a & SM_MIDI_MASK_MSG) {
+   case SM_MIDI_CONTROLLER:
+     if (song_thin_keep_controller(e.b))
+       return false;
+     *key = (e.a << 8) | e.b;
+     *value = e.c;
+     return true;
+
+   case SM_MIDI_PRESSURE:
+     *key = (e.a << 8) | e.b;
+     *value = e.c;
+     return true;
+
+   case SM_MIDI_CHANNEL_PRESSURE:
+     *key = e.a << 8;
+     *value = e.b;
+     return true;
+
+   case SM_MIDI_PITCH_BEND:
+     *key = e.a << 8;
+     *value = (e.c << 7) | e.b;
+     *scale = 128;
+     return true;
+  }
+
+  return false;
+}
+
+// decide what happens to an event of a stream. an event held before a kept one ends the
+// previous burst and is written, one held before a dropped or held event is superseded.
+static int song_thin_check(song_thin_state_t &s, const song_thin_t &thin, uint time, int value, int scale) {
+  if (!s.active ||
+      (thin.interval && time - s.time >= thin.interval) ||
+      (thin.tolerance && abs(value - s.value) >= thin.tolerance * scale)) {
+    s.active = true;
+    s.time = time;
+    s.value = value;
+    return SONG_THIN_KEEP;
+  }
+
+  return value == s.value ? SONG_THIN_DROP : SONG_THIN_HOLD;
+}
+
+// stream of the record track
+struct song_thin_stream_t {
+  uint generation;            // stream is unused when generation differs
+  song_thin_state_t state;
+  bool holding;
+  song_event_t held;
+};
+
+static song_thin_stream_t song_thin_streams[SONG_THIN_STREAMS];
+static uint song_thin_generation = 0;
+static song_thin_t song_thin_record = {0, 0};
+
+// streams holding an event, in no order
+static ushort song_thin_held[SONG_THIN_HELD_MAX];
+static uint song_thin_held_count = 0;
+
+static void song_append_event(const song_event_t &e);
+
+// start thinning a take
+static void song_thin_begin() {
+  song_thin_record.interval = 0;
+  song_thin_record.tolerance = config_get_record_thin();
+  song_thin_generation++;
+  song_thin_held_count = 0;
+}
+
+// drop held event of a stream
+static void song_thin_release(ushort key) {
+  song_thin_streams[key].holding = false;
+
+  for (uint i = 0; i < song_thin_held_count; i++) {
+    if (song_thin_held[i] == key) {
+      song_thin_held[i] = song_thin_held[--song_thin_held_count];
+      break;
+    }
+  }
+}
+
+// write held events in time order, they precede any event written after them
+static void song_thin_flush() {
+  for (uint i = 1; i < song_thin_held_count; i++) {
+    ushort key = song_thin_held[i];
+    uint j = i;
+
+    while (j > 0 && song_thin_streams[song_thin_held[j - 1]].held.time > song_thin_streams[key].held.time) {
+      song_thin_held[j] = song_thin_held[j - 1];
+      j--;
+    }
+    song_thin_held[j] = key;
+  }
+
+  for (uint i = 0; i < song_thin_held_count; i++) {
+    song_thin_stream_t &s = song_thin_streams[song_thin_held[i]];
+    s.holding = false;
+    song_append_event(s.held);
+  }
+
+  song_thin_held_count = 0;
+}
+
+// thin a recorded event, returns true when it is not written now
+static bool song_thin_event(const song_event_t &e) {
+  ushort key;
+  int value;
+  int scale;
+
+  if (song_thin_record.tolerance <= 0 || !song_thin_classify(e, &key, &value, &scale))
+    return false;
+
+  song_thin_stream_t &s = song_thin_streams[key];
+
+  if (s.generation != song_thin_generation) {
+    s.generation = song_thin_generation;
+    s.state.active = false;
+    s.holding = false;
+  }
+
+  int result = song_thin_check(s.state, song_thin_record, e.time, value, scale);
+
+  // the held event is replaced by this one
+  if (s.holding && result != SONG_THIN_KEEP)
+    song_thin_release(key);
+
+  switch (result) {
+   case SONG_THIN_DROP:
+     return true;
+
+   case SONG_THIN_HOLD:
+     if (song_thin_held_count < SONG_THIN_HELD_MAX) {
+       s.holding = true;
+       s.held = e;
+       song_thin_held[song_thin_held_count++] = key;
+       return true;
+     }
+     break;
+  }
+
+  return false;
+}
+
+// stop thinning, held events were written before the stop event
+static void song_thin_end() {
+  song_thin_flush();
+  song_thin_record.tolerance = 0;
+}
+
+// discard thinning state of an abandoned take
+static void song_thin_clear() {
+  song_thin_held_count = 0;
+  song_thin_record.tolerance = 0;
+}
+
 // -----------------------------------------------------------------------------------------
 // record and playback
 // -----------------------------------------------------------------------------------------
 
+// write event to record track and journal
+static void song_append_event(const song_event_t &e) {
+  song_event_store_t &events = song_tracks[song_record_track].events;
+  if (event_store_record(events, e))
+    song_journal_event(e);
+  else
+    InterlockedIncrement(&song_record_overflow);
+}
+
 // add event
 static void song_add_event(double time, byte a, byte b, byte c, byte d) {
-  if (record_position) {
-    record_position->time = time;
-    record_position->a = a;
-    record_position->b = b;
-    record_position->c = c;
-    record_position->d = d;
+  if (song_recording) {
+    song_event_t e = { song_ms_to_tick(time), a, b, c, d };
 
-    ++record_position;
+    if (song_thin_event(e))
+      return;
 
-    // just simple set song end to record posision
-    song_end = record_position;
+    song_thin_flush();
+    song_append_event(e);
 
-    // auto stop record
-    if (record_position == ARRAY_END(song_event_buffer) - 1) {
+    // auto stop record, keep a slot for the stop event
+    if (song_tracks[song_record_track].events.size >= song_event_capacity - SONG_THIN_HELD_MAX - 1) {
       song_stop_record();
     }
   }
@@ -764,11 +2182,22 @@ static void song_add_event(double time, byte a, byte b, byte c, byte d) {
 // init record
 static void song_init_record() {
   song_timer = 0;
+  song_tick = 0;
   song_clock = 0;
   song_auto_pedal_timer = 0;
-  record_position = song_event_buffer;
-  play_position = NULL;
-  song_end = song_event_buffer;
+  song_loader_stop();
+  song_snapshot_clear();
+  song_thin_clear();
+  for (uint i = 1; i < SONG_TRACK_MAX; i++)
+    event_store_free(song_tracks[i].events);
+  event_store_reset(song_events);
+  song_settings_clear(song_settings);
+  song_loop_clear();
+  song_track_count = 1;
+  song_record_track = 0;
+  song_recording = true;
+  song_playing = false;
+  song_opened = true;
   song_info.version = current_version;
   song_info.author[0] = 0;
   song_info.title[0] = 0;
@@ -777,22 +2206,32 @@ static void song_init_record() {
   song_info.compatibility = true;
 
   song_play_speed = 1;
+  song_clock_publish();
 }
 
-// reset
-static void song_reset_event() {
+// reset keyboard and song event state
+static void song_reset_input() {
   // exit key map mode
   keyboard_map_key_code = 0;
 
   // exit key label mode
   keyboard_label_key_size = 0;
 
+  // drop incomplete setting snapshot
+  song_settings_header = false;
+  song_settings_size = 0;
+
   // reset keyboard
   keyboard_reset();
 
   // reset sync and delay events
   sync_event_reset();
   delay_event_reset();
+}
+
+// reset song events and midi output
+static void song_reset_event() {
+  song_reset_input();
 
   // reset midi
   midi_reset();
@@ -805,142 +2244,105 @@ void song_start_record() {
   song_stop_playback();
   song_stop_record();
   song_init_record();
+  song_journal_discard();
+  song_journal_begin();
 
-  int current_group = config_get_setting_group();
-  int total_groups = config_get_setting_group_count();
-
-  // record config groups
-  song_add_event(0, SM_SETTING_GROUP_COUNT, total_groups, 0, 0);
-
-  // record group settings
-  for (int i = 0; i < total_groups; i++) {
-    // change current setting group
-    config_set_setting_group(i);
-    song_add_event(0, SM_SETTING_GROUP, SM_VALUE_SET, i, 0);
-
-    // record current configs
-    song_add_event(0, SM_KEY_SIGNATURE, SM_VALUE_SET, config_get_key_signature(), 0);
-
-    // record input settings
-    for (int ch = SM_INPUT_0; ch <= SM_INPUT_MAX; ch++) {
-      if (config_get_key_octshift(ch))
-        song_add_event(0, SM_OCTAVE, ch, SM_VALUE_SET, config_get_key_octshift(ch));
-
-      if (config_get_key_transpose(ch))
-        song_add_event(0, SM_TRANSPOSE, ch, SM_VALUE_SET, config_get_key_transpose(ch));
-
-      if (config_get_key_velocity(ch) != 127)
-        song_add_event(0, SM_VELOCITY, ch, SM_VALUE_SET, config_get_key_velocity(ch));
-
-      if (config_get_output_channel(ch))
-        song_add_event(0, SM_CHANNEL, ch, SM_VALUE_SET, config_get_output_channel(ch));
-    }
-
-    // record output settings
-    for (int ch = SM_OUTPUT_0; ch <= SM_OUTPUT_MAX; ch++) {
-      // program
-      if (config_get_program(ch) < 128)
-        song_add_event(0, SM_PROGRAM, ch, SM_VALUE_SET, config_get_program(ch));
+  // record all setting groups as one snapshot
+  uint size = config_encode_settings(NULL, 0);
+  std::vector<byte> data((size + 3) & ~3);
+  config_encode_settings(&data[0], size);
 
-      // bank msb
-      if (config_get_controller(ch, 0) < 128)
-        song_add_event(0, SM_BANK_MSB, ch, SM_VALUE_SET, config_get_controller(ch, 0));
+  // playback restores the decoded snapshot
+  long slot = song_settings_reserve(song_settings);
+  song_settings_store(song_settings, slot, config_decode_settings(&data[0], size));
 
-      // bank lsb
-      if (config_get_controller(ch, 32) < 128)
-        song_add_event(0, SM_BANK_LSB, ch, SM_VALUE_SET, config_get_controller(ch, 32));
+  song_add_event(0, SM_SYSTEM, SMS_SETTINGS, (slot + 1) >> 8, slot + 1);
+  song_add_event(0, size >> 24, size >> 16, size >> 8, size);
 
-      // sustain
-      if (config_get_controller(ch, 64) < 128)
-        song_add_event(0, SM_SUSTAIN, ch, SM_VALUE_SET, config_get_controller(ch, 64));
+  for (uint i = 0; i < data.size(); i += 4)
+    song_add_event(0, data[i], data[i + 1], data[i + 2], data[i + 3]);
 
-      // modulation
-      if (config_get_controller(ch, 1) < 128)
-        song_add_event(0, SM_MODULATION, ch, SM_VALUE_SET, config_get_controller(ch, 1));
-    }
-
-    // record keymaps
-    for (int i = 0; i < 256; i++) {
-      int count;
-      key_bind_t bind[256];
-
-      count = config_bind_get_keydown(i, bind, 256);
-      for (int j = 0; j < count; j++) {
-        if (bind[j].a) {
-          song_add_event(0, SM_SYSTEM, SMS_KEY_MAP, i, 0);
-          song_add_event(0, bind[j].a, bind[j].b, bind[j].c, bind[j].d);
-        }
-      }
-
-      count = config_bind_get_keyup(i, bind, 256);
-      for (int j = 0; j < count; j++) {
-        if (bind[j].a) {
-          song_add_event(0, SM_SYSTEM, SMS_KEY_MAP, i, 1);
-          song_add_event(0, bind[j].a, bind[j].b, bind[j].c, bind[j].d);
-        }
-      }
-
-      if (*config_bind_get_label(i)) {
-        const char *label = config_bind_get_label(i);
-        int size = strlen(label);
-
-        song_add_event(0, SM_SYSTEM, SMS_KEY_LABEL, i, size);
-
-        for (int i = 0; i < (size + 3) / 4; i++) {
-          song_add_event(0, label[0], label[1], label[2], label[3]);
-          label += 4;
-        }
-      }
-
-      if (config_bind_get_color(i)) {
-        uint color = config_bind_get_color(i);
-        song_add_event(0, SM_SYSTEM, SMS_KEY_COLOR, i, 1);
-        song_add_event(0, color >> 24, color >> 16, color >> 8, color);
-      }
-    }
-  }
+  // select current group, sends its midi state
+  song_add_event(0, SM_SETTING_GROUP, 0, config_get_setting_group(), 0);
 
-  // restore current group
-  config_set_setting_group(current_group);
-  song_add_event(0, SM_SETTING_GROUP, 0, current_group, 0);
+  // setting payload is never thinned
+  song_thin_begin();
 }
 
 // stop record
 void song_stop_record() {
   thread_lock lock(song_lock);
 
-  if (record_position) {
+  if (song_recording) {
     song_add_event(song_timer, SM_STOP, 0, 0, 0);
+    song_thin_end();
+    song_journal_end();
     song_reset_event();
-    record_position = NULL;
+    song_recording = false;
+
+    // overdub ends with playback, seek index is rebuilt by the worker
+    if (song_record_track) {
+      song_record_track = 0;
+      song_playing = false;
+      song_snapshot_clear();
+      song_loop_clear();
+      song_worker_signal();
+    }
   }
 }
 
+// allow overdub
+bool song_allow_overdub() {
+  thread_lock lock(song_lock);
+  return song_allow_save() && song_track_count < SONG_TRACK_MAX;
+}
+
+// play song and record input into a new track
+void song_start_overdub() {
+  thread_lock lock(song_lock);
+
+  if (!song_allow_overdub())
+    return;
+
+  song_loader_wait();
+  song_loop_clear();
+  song_start_playback();
+
+  // existing tracks are already in the play heap, the new one only records
+  song_record_track = song_track_count++;
+  event_store_reset(song_tracks[song_record_track].events);
+  song_recording = true;
+  song_journal_begin();
+  song_thin_begin();
+}
+
 // is recoding
 bool song_is_recording() {
   thread_lock lock(song_lock);
 
-  return record_position != NULL;
+  return song_recording;
 }
 
 // start playback
 void song_start_playback() {
   thread_lock lock(song_lock);
 
-  if (song_end) {
+  if (song_opened) {
     song_stop_record();
     song_stop_playback();
 
     song_timer = 0;
+    song_tick = 0;
     song_clock = 0;
     song_auto_pedal_timer = 0;
-    play_position = song_event_buffer;
+    play_position_seek(NULL);
+    song_playing = true;
 
     // clear current setting
     config_set_setting_group_count(1);
     config_clear_key_setting();
 
-    song_update(0);
+    song_update(0, 0);
   }
 }
 
@@ -949,14 +2351,14 @@ void song_stop_playback() {
   thread_lock lock(song_lock);
 
   song_reset_event();
-  play_position = NULL;
+  song_playing = false;
 }
 
 // is recoding
 bool song_is_playing() {
   thread_lock lock(song_lock);
 
-  return play_position != NULL;
+  return song_playing;
 }
 
 
@@ -964,8 +2366,22 @@ bool song_is_playing() {
 int song_get_length() {
   thread_lock lock(song_lock);
 
-  if (song_end && song_end > song_event_buffer)
-    return (int)song_end[-1].time;
+  if (song_opened) {
+    uint time = 0;
+
+    for (uint i = 0; i < song_track_count; i++) {
+      song_event_store_t &events = song_tracks[i].events;
+
+      if (events.size && event_store_at(events, events.size - 1)->time > time)
+        time = event_store_at(events, events.size - 1)->time;
+    }
+
+    // last block starts no later than the end of song
+    if (song_loading && song_loading_length > time)
+      time = song_loading_length;
+
+    return (int)song_tick_to_ms(time);
+  }
 
   return 0;
 }
@@ -973,78 +2389,221 @@ int song_get_length() {
 // allow save
 bool song_allow_save() {
   thread_lock lock(song_lock);
-  return song_end != NULL && !song_info.write_protected && !song_is_recording();
+  return song_opened && !song_info.write_protected && !song_is_recording();
 }
 
 // allow input
 bool song_allow_input() {
   thread_lock lock(song_lock);
-  return play_position == NULL;
+  return !song_playing;
 }
 
 // song has data
 bool song_is_empty() {
   thread_lock lock(song_lock);
-  return song_end == NULL;
+  return !song_opened;
 }
 
 
-// get time
-int song_get_time() {
-  thread_lock lock(song_lock);
-  return (int)song_timer;
-}
+// advance a time value by whole samples, scale is ms per sample
+static void song_sample_clock_advance(song_sample_clock_t &c, double &value, uint samples, double scale) {
+  if (value != c.value || scale != c.scale) {
+    c.samples = 0;
+    c.origin = value;
+    c.scale = scale;
+  }
 
-// get clock
-double song_get_clock() {
-  thread_lock lock(song_lock);
-  return song_clock;
+  c.samples += samples;
+  c.value = c.origin + c.samples * c.scale;
+  value = c.value;
 }
 
-// song get play speed
-double song_get_play_speed() {
-  return song_play_speed;
+// publish timer and clock, song lock must be held
+static void song_clock_publish() {
+  song_clock_seqlock_t &p = song_published_clock;
+
+  InterlockedIncrement(&p.sequence);
+  p.timer = song_timer;
+  p.clock = song_clock;
+  InterlockedIncrement(&p.sequence);
 }
 
-// song get play speed
-void song_set_play_speed(double speed) {
+// read published timer and clock
+static void song_clock_read(double *timer, double *clock) {
+  song_clock_seqlock_t &p = song_published_clock;
+
+  for (;;) {
+    LONG sequence = p.sequence;
+
+    // writer is between the two increments
+    if (sequence & 1) {
+      YieldProcessor();
+      continue;
+    }
+
+    MemoryBarrier();
+    double t = p.timer;
+    double c = p.clock;
+    MemoryBarrier();
+
+    if (p.sequence == sequence) {
+      if (timer) *timer = t;
+      if (clock) *clock = c;
+      return;
+    }
+  }
+}
+
+// get time
+int song_get_time() {
+  double timer;
+  song_clock_read(&timer, NULL);
+  return (int)timer;
+}
+
+// get clock
+double song_get_clock() {
+  double clock;
+  song_clock_read(NULL, &clock);
+  return clock;
+}
+
+// song get play speed
+double song_get_play_speed() {
+  return song_play_speed;
+}
+
+// song get play speed
+void song_set_play_speed(double speed) {
   song_play_speed = speed;
   if (song_play_speed < 0)
     song_play_speed = 0;
 }
 
+// sample offset of a song time inside current block
+static inline uint song_block_offset(double time, double block_start, uint samples, double time_elapsed) {
+  if (samples == 0 || time_elapsed <= 0)
+    return 0;
+
+  double offset = (time - block_start) * samples / time_elapsed;
+  return offset <= 0 ? 0 : offset >= samples ? samples - 1 : (uint)offset;
+}
+
 // update
-void song_update(double time_elapsed) {
+void song_update(uint samples, uint samplerate) {
   thread_lock lock(song_lock);
 
+  double time_elapsed = samplerate ? 1000.0 * samples / samplerate : 0;
+
+  // process input events
+  song_update_heartbeat = GetTickCount();
+  song_input_drain(samples, samplerate);
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  song_update_counter = counter.QuadPart;
+
+  if (song_counter_frequency == 0) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    song_counter_frequency = frequency.QuadPart;
+  }
+
 #ifdef _DEBUG
   if (GetAsyncKeyState(VK_ESCAPE))
     return;
 #endif
 
   // adjust playing speed
-  if (song_is_playing())
+  double scale = samplerate ? 1000.0 / samplerate : 0;
+
+  if (song_is_playing()) {
     time_elapsed *= song_play_speed;
+    scale *= song_play_speed;
+  }
+
+  // song time covered by this block
+  double block_start = song_timer;
 
-  if (song_is_playing() || song_is_recording())
-    song_timer += time_elapsed;
+  if (song_is_playing() || song_is_recording()) {
+    song_sample_clock_advance(song_timer_samples, song_timer, samples, scale);
+    song_tick = song_ms_to_tick(song_timer);
+  }
 
   // playback
-  while (play_position && song_end) {
-    if (play_position->time <= song_timer) {
-      // send event to keyboard
-      song_send_event(play_position->a, play_position->b, play_position->c, play_position->d);
+  bool was_playing = song_playing;
+  song_realtime = true;
+
+  while (song_playing) {
+    song_event_t *e = play_position_peek();
+
+    // wrap at loop end once every event before it is played
+    if (song_loop_enabled && song_tick >= song_loop_end && (e == NULL || e->time >= song_loop_end)) {
+      double loop_start = song_tick_to_ms(song_loop_start);
+      double loop_end = song_tick_to_ms(song_loop_end);
+      double overshoot = song_timer - loop_end;
+
+      // restart exactly at the sample where the loop ends
+      song_event_offset = song_block_offset(loop_end, block_start, samples, time_elapsed);
+      song_loop_wrap();
+      song_event_offset = 0;
+
+      // rest of the block plays from loop start
+      block_start += loop_start - loop_end;
+      song_timer += overshoot;
+      song_tick = song_ms_to_tick(song_timer);
+      continue;
+    }
 
-      if (play_position) {
-        if (++play_position >= song_end) {
-          song_stop_playback();
+    if (e == NULL) {
+      // wait for loader
+      if (play_position_end())
+        song_stop_playback();
+      break;
+    }
+
+    if (e->time <= song_tick) {
+      // next playlist song starts at the sample where this one ends
+      if (e->a == SM_STOP && play_position_tracks() == 1) {
+        double end = song_tick_to_ms(e->time);
+
+        if (song_playlist_swap()) {
+          block_start -= end;
+          song_timer -= end;
+          song_tick = song_ms_to_tick(song_timer);
+          continue;
         }
       }
+
+      // place event inside the block
+      song_event_offset = song_block_offset(song_tick_to_ms(e->time), block_start, samples, time_elapsed);
+
+      // send event to keyboard, a track ending does not stop the others
+      if (e->a != SM_STOP || play_position_tracks() == 1)
+        song_send_event(e->a, e->b, e->c, e->d);
+      song_event_offset = 0;
+
+      if (song_playing) {
+        play_position_next();
+
+        if (play_position_end())
+          song_stop_playback();
+      }
     } else break;
   }
 
+  song_realtime = false;
+
+  // values and key binds deferred by this update are published by the worker
+  if (config_values_deferred() || config_bind_deferred())
+    song_worker_signal();
+
+  if (was_playing && !song_playing)
+    song_playlist_stopped();
+
   // adjust clock
-  song_clock += time_elapsed;
+  song_sample_clock_advance(song_clock_samples, song_clock, samples, scale);
+  song_clock_publish();
 
   // update keyboard
   keyboard_update(time_elapsed);
@@ -1057,13 +2616,856 @@ void song_update(double time_elapsed) {
   pitch_update(time_elapsed);
 }
 
-song_info_t* song_get_info() {
-  return &song_info;
-}
+song_info_t* song_get_info() {
+  return &song_info;
+}
+
+void song_trigger_sync(uint flags) {
+  thread_lock lock(song_lock);
+  sync_trigger |= flags;
+}
+
+// -----------------------------------------------------------------------------------------
+// seek
+// -----------------------------------------------------------------------------------------
+// snapshots of the playback state are taken every few seconds of song time, seeking
+// restores the nearest snapshot before the target and replays the rest silently.
+// the index is built by the worker as soon as the song is loaded, one interval per
+// song lock, so playback only waits for a single slice of the replay.
+#define SONG_SNAPSHOT_INTERVAL    (5000 * SONG_TICKS_PER_MS)
+
+struct song_snapshot_note_t {
+  byte ch;
+  byte note;
+  byte velocity;
+};
+
+struct song_snapshot_t {
+  uint index[SONG_TRACK_MAX];
+  uint time;
+  config_state_t *config;
+  keyboard_state_t *keyboard;
+  std::vector<song_snapshot_note_t> *notes;
+  char pitch[16];
+};
+
+static std::vector<song_snapshot_t> song_snapshots;
+static bool song_snapshots_valid = false;
+
+// seek index of current song is incomplete
+static volatile bool song_snapshots_pending = false;
+
+// free a snapshot
+static void song_snapshot_free(song_snapshot_t &s) {
+  config_free_state(s.config);
+  keyboard_free_state(s.keyboard);
+  delete s.notes;
+  s.config = NULL;
+  s.keyboard = NULL;
+  s.notes = NULL;
+}
+
+// free snapshots
+static void song_snapshot_clear() {
+  for (auto it = song_snapshots.begin(); it != song_snapshots.end(); ++it)
+    song_snapshot_free(*it);
+
+  song_snapshots.clear();
+  song_snapshots_valid = false;
+  song_snapshots_pending = true;
+}
+
+// build seek index of current song in background
+static void song_snapshot_request() {
+  song_snapshots_pending = true;
+  song_worker_signal();
+}
+
+// take a snapshot of current state
+static void song_snapshot_take(song_snapshot_t &s, uint time) {
+  play_position_get(s.index);
+  s.time = time;
+  s.config = config_save_state();
+  s.keyboard = keyboard_save_state();
+  s.notes = new std::vector<song_snapshot_note_t>;
+
+  for (int ch = 0; ch < 16; ch++) {
+    for (int note = 0; note < 128; note++) {
+      byte velocity = midi_get_note_status(ch, note);
+
+      if (velocity) {
+        song_snapshot_note_t n = { (byte)ch, (byte)note, velocity };
+        s.notes->push_back(n);
+      }
+    }
+
+    s.pitch[ch] = pitch_smooth[ch].target;
+  }
+}
+
+// take a snapshot into seek index
+static void song_snapshot_capture(uint time) {
+  song_snapshot_t s;
+  song_snapshot_take(s, time);
+  song_snapshots.push_back(s);
+}
+
+// restore playback state of a snapshot except setting groups
+static void song_snapshot_restore_playback(song_snapshot_t &s) {
+  keyboard_restore_state(s.keyboard);
+
+  for (auto it = s.notes->begin(); it != s.notes->end(); ++it)
+    midi_output_event(SM_MIDI_NOTEON | it->ch, it->note, it->velocity, 0);
+
+  for (int ch = 0; ch < 16; ch++) {
+    pitch_smooth[ch].target = s.pitch[ch];
+    pitch_smooth[ch].current = s.pitch[ch];
+    pitch_smooth[ch].timer = 0;
+  }
+
+  song_timer = song_tick_to_ms(s.time);
+  song_tick = s.time;
+  play_position_seek(s.index);
+}
+
+// restore a snapshot, output should be muted
+static void song_snapshot_restore(song_snapshot_t &s) {
+  config_restore_state(s.config);
+  song_snapshot_restore_playback(s);
+}
+
+// advance timers to tick while replaying
+static void song_replay_advance(uint tick) {
+  double time_elapsed = song_tick_to_ms(tick) - song_timer;
+
+  if (time_elapsed > 0) {
+    song_timer = song_tick_to_ms(tick);
+    song_tick = tick;
+
+    sync_event_update(time_elapsed);
+    delay_event_update(time_elapsed);
+  }
+}
+
+// replay events up to tick from play position, output should be muted
+static void song_replay_to(uint tick) {
+  while (song_event_t *e = play_position_peek()) {
+    if (e->time > tick)
+      break;
+
+    // leave last stop event to playback
+    if (e->a == SM_STOP) {
+      if (play_position_tracks() == 1)
+        break;
+
+      play_position_next();
+      continue;
+    }
+
+    song_replay_advance(e->time);
+    song_send_event(e->a, e->b, e->c, e->d);
+    play_position_next();
+  }
+
+  song_replay_advance(tick);
+
+  // settle smoothed pitch
+  for (int ch = 0; ch < 16; ch++) {
+    pitch_smooth[ch].current = pitch_smooth[ch].target;
+    pitch_smooth[ch].timer = 0;
+  }
+}
+
+// state kept across a silent replay
+struct song_replay_state_t {
+  song_snapshot_t live;
+  smooth_param_t pitch[16];
+  double timer;
+};
+
+// start silent replay from the beginning of the song
+static void song_replay_begin(song_replay_state_t &state) {
+  // nothing reaches the output until the replay ends
+  midi_set_output_mute(true);
+
+  // keep current state, sounding notes and pending keyups included
+  song_snapshot_take(state.live, song_tick);
+  memcpy(state.pitch, pitch_smooth, sizeof(state.pitch));
+  state.timer = song_timer;
+
+  song_reset_event();
+
+  // songs always start with a clear setting
+  config_set_setting_group_count(1);
+  config_clear_key_setting();
+  memset(pitch_smooth, 0, sizeof(pitch_smooth));
+  song_timer = 0;
+  song_tick = 0;
+
+  play_position_seek(NULL);
+}
+
+// finish silent replay and restore state
+static void song_replay_end(song_replay_state_t &state) {
+  // replayed notes are dropped and live ones restored, still muted
+  song_reset_event();
+  song_snapshot_restore(state.live);
+  song_snapshot_free(state.live);
+  midi_set_output_mute(false);
+
+  memcpy(pitch_smooth, state.pitch, sizeof(state.pitch));
+  song_timer = state.timer;
+}
+
+// replay one interval of the song into the seek index, song lock must be held.
+// returns true when more of the index is left to build.
+static bool song_snapshot_build_step() {
+  if (!song_snapshots_pending)
+    return false;
+
+  // the index covers the complete song
+  if (song_recording || song_loading)
+    return false;
+
+  if (!song_opened) {
+    song_snapshots_pending = false;
+    return false;
+  }
+
+  song_replay_state_t state;
+  song_replay_begin(state);
+
+  // continue from the last snapshot
+  uint next_time = 0;
+  if (!song_snapshots.empty()) {
+    song_snapshot_restore(song_snapshots.back());
+    next_time = song_snapshots.back().time + SONG_SNAPSHOT_INTERVAL;
+  }
+
+  bool captured = false;
+  bool more = false;
+
+  while (song_event_t *e = play_position_peek()) {
+    if (e->a == SM_STOP) {
+      if (play_position_tracks() == 1)
+        break;
+
+      play_position_next();
+      continue;
+    }
+
+    // snapshot only between complete commands
+    if (e->time >= next_time &&
+        keyboard_map_key_code == 0 &&
+        keyboard_label_key_size == 0 &&
+        keyboard_color_key_code == 0) {
+      // next slice starts here
+      if (captured) {
+        more = true;
+        break;
+      }
+
+      song_replay_advance(e->time);
+      song_snapshot_capture(e->time);
+      next_time = e->time + SONG_SNAPSHOT_INTERVAL;
+      captured = true;
+    }
+
+    song_replay_advance(e->time);
+    song_send_event(e->a, e->b, e->c, e->d);
+    play_position_next();
+  }
+
+  song_replay_end(state);
+
+  if (!more) {
+    song_snapshots_valid = true;
+    song_snapshots_pending = false;
+  }
+  return more;
+}
+
+// build the rest of the seek index, song lock is released between slices
+static void song_snapshot_complete() {
+  for (;;) {
+    thread_lock lock(song_lock);
+
+    if (!song_snapshot_build_step())
+      break;
+  }
+}
+
+// send restored state to output
+static void song_send_output_state() {
+  midi_resend_state();
+  for (int ch = 0; ch < 16; ch++)
+    midi_output_event(SM_MIDI_PITCH_BEND | ch, 0, 64 + clamp_value<char>(pitch_smooth[ch].current, -64, 63), 0);
+}
+
+// seek
+void song_seek(int time) {
+  {
+    thread_lock lock(song_lock);
+
+    if (!song_opened)
+      return;
+
+    song_stop_record();
+    song_loader_wait();
+  }
+
+  // index is normally complete already
+  song_snapshot_complete();
+
+  thread_lock lock(song_lock);
+
+  if (!song_snapshots_valid || song_snapshots.empty())
+    return;
+
+  uint tick = song_ms_to_tick(time);
+
+  // find last snapshot before time
+  uint lo = 0;
+  uint hi = song_snapshots.size();
+  while (hi - lo > 1) {
+    uint mid = (lo + hi) / 2;
+
+    if (song_snapshots[mid].time <= tick)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  // stop sounding notes
+  song_reset_event();
+
+  midi_set_output_mute(true);
+  song_snapshot_restore(song_snapshots[lo]);
+  song_replay_to(tick);
+  config_bind_update();
+  midi_set_output_mute(false);
+
+  // send current state to output
+  song_send_output_state();
+
+  song_playing = true;
+  song_clock_publish();
+}
+
+// -----------------------------------------------------------------------------------------
+// loop
+// -----------------------------------------------------------------------------------------
+// the state at loop start is captured once when the loop is set, every wrap restores it
+// directly instead of restarting playback and replaying the song header. its setting
+// groups are prepared by the worker and installed by pointer. controllers and programs
+// set at loop start are listed once too, a wrap only sends the ones that changed.
+#define SONG_LOOP_MIN             (50 * SONG_TICKS_PER_MS)
+#define SONG_LOOP_PROGRAM         0xff
+#define SONG_LOOP_OUTPUT_MAX      (16 * 129)
+
+struct song_loop_output_t {
+  byte ch;
+  byte controller;
+  byte value;
+  bool changed;
+};
+
+static song_snapshot_t song_loop_entry = {0};
+static song_loop_output_t song_loop_output[SONG_LOOP_OUTPUT_MAX];
+static uint song_loop_output_count = 0;
+
+// loop state waits to be released by the worker
+static volatile bool song_loop_stale = false;
+
+// release loop start state
+static void song_loop_release() {
+  thread_lock lock(song_worker_lock);
+
+  song_prepared_set(song_loop_config, NULL);
+  song_snapshot_free(song_loop_entry);
+  song_loop_output_count = 0;
+  song_loop_stale = false;
+}
+
+// clear loop, may be called by the audio thread so its state is released by the worker
+static void song_loop_clear() {
+  if (song_loop_enabled) {
+    song_loop_enabled = false;
+    song_loop_stale = true;
+    song_worker_signal();
+  }
+}
+
+// list controllers and programs at loop start
+static void song_loop_capture_output() {
+  song_loop_output_count = 0;
+
+  for (int ch = 0; ch < 16; ch++) {
+    song_loop_output_t o = { (byte)ch, 0, 0, false };
+
+    for (int i = 0; i < 128; i++) {
+      o.controller = i;
+      o.value = config_get_controller(SM_OUTPUT_0 + ch, i);
+      if (o.value < 128)
+        song_loop_output[song_loop_output_count++] = o;
+    }
+
+    o.controller = SONG_LOOP_PROGRAM;
+    o.value = config_get_program(SM_OUTPUT_0 + ch);
+    if (o.value < 128)
+      song_loop_output[song_loop_output_count++] = o;
+  }
+}
+
+// jump back to loop start
+static void song_loop_wrap() {
+  char pitch[16];
+
+  // values playing now, compared before the entry state is restored
+  for (uint i = 0; i < song_loop_output_count; i++) {
+    song_loop_output_t &o = song_loop_output[i];
+    byte value = o.controller == SONG_LOOP_PROGRAM ?
+                 config_get_program(SM_OUTPUT_0 + o.ch) :
+                 config_get_controller(SM_OUTPUT_0 + o.ch, o.controller);
+    o.changed = value != o.value;
+  }
+
+  for (int ch = 0; ch < 16; ch++)
+    pitch[ch] = pitch_smooth[ch].current;
+
+  // stop sounding notes, controllers are kept
+  song_reset_input();
+  midi_release_notes();
+
+  // groups of loop start, current groups are kept when the worker is not ready yet
+  song_prepared_install(song_loop_config);
+
+  // entry notes go out directly
+  song_snapshot_restore_playback(song_loop_entry);
+
+  for (uint i = 0; i < song_loop_output_count; i++) {
+    const song_loop_output_t &o = song_loop_output[i];
+
+    if (o.changed) {
+      if (o.controller == SONG_LOOP_PROGRAM)
+        midi_output_event(SM_MIDI_PROGRAM | o.ch, o.value, 0, 0);
+      else
+        midi_output_event(SM_MIDI_CONTROLLER | o.ch, o.controller, o.value, 0);
+    }
+  }
+
+  for (int ch = 0; ch < 16; ch++) {
+    if (pitch[ch] != song_loop_entry.pitch[ch])
+      midi_output_event(SM_MIDI_PITCH_BEND | ch, 0, 64 + clamp_value<char>(song_loop_entry.pitch[ch], -64, 63), 0);
+  }
+}
+
+// set loop region
+void song_set_loop(int start, int end) {
+  thread_lock lock(song_lock);
+
+  song_loop_clear();
+  song_loop_release();
+
+  if (!song_opened)
+    return;
+
+  uint start_tick = song_ms_to_tick(start);
+  uint end_tick = song_ms_to_tick(end);
+  uint length = song_ms_to_tick(song_get_length());
+
+  if (end_tick > length)
+    end_tick = length;
+
+  if (end_tick < start_tick + SONG_LOOP_MIN)
+    return;
+
+  // play from loop start and keep its state for every wrap
+  song_seek(start);
+  if (!song_playing)
+    return;
+
+  song_snapshot_take(song_loop_entry, start_tick);
+  song_prepared_set(song_loop_config, song_loop_entry.config);
+  song_loop_capture_output();
+  song_loop_start = start_tick;
+  song_loop_end = end_tick;
+  song_loop_enabled = true;
+}
+
+// get loop region, returns false when no loop is set
+bool song_get_loop(int *start, int *end) {
+  thread_lock lock(song_lock);
+
+  if (!song_loop_enabled)
+    return false;
+
+  *start = (int)song_tick_to_ms(song_loop_start);
+  *end = (int)song_tick_to_ms(song_loop_end);
+  return true;
+}
+
+// -----------------------------------------------------------------------------------------
+// worker
+// -----------------------------------------------------------------------------------------
+// prepare states consumed by playback and publish config values deferred by it
+static void song_worker_service() {
+  {
+    thread_lock lock(song_worker_lock);
+
+    if (song_loop_stale)
+      song_loop_release();
+
+    song_prepared_service(song_loop_config);
+
+    for (uint t = 0; t < ARRAY_COUNT(song_settings_tables); t++) {
+      song_settings_t &settings = song_settings_tables[t];
+
+      for (long i = 0; i < settings.count && i < SONG_SETTINGS_MAX; i++)
+        song_prepared_service(settings.states[i]);
+    }
+
+    config_bind_update();
+    config_values_update();
+  }
+
+  // seek index takes the song lock, never while holding the worker lock
+  song_snapshot_complete();
+}
+
+// -----------------------------------------------------------------------------------------
+// transform
+// -----------------------------------------------------------------------------------------
+// offline edits of recorded tracks. event times and note velocities are copied to flat
+// columns, transformed in tight loops and written back in place, a track is re-sorted
+// only when quantize moved events across each other. payload events following system
+// events (labels, colors, key maps) are never touched and stay next to their header.
+
+enum song_transform_kind_t {
+  SONG_KIND_OTHER,
+  SONG_KIND_PAYLOAD,
+  SONG_KIND_NOTE_ON,
+  SONG_KIND_NOTE_OFF,
+  SONG_KIND_CONTROLLER,
+  SONG_KIND_STOP,
+  SONG_KIND_DROPPED,
+};
+
+// pairing keys: 16 channels * 128 notes, then 256 keyboard keys
+#define SONG_TRANSFORM_NOTE_KEYS  (16 * 128 + 256)
+
+// columns of a track while transforming
+struct song_transform_columns_t {
+  std::vector<byte> kind;
+  std::vector<uint> time;
+  std::vector<byte> velocity;
+  std::vector<ushort> key;
+  std::vector<int> value;
+  std::vector<byte> scale;
+};
+
+// classify events, note keys pair note on and off, controller keys identify a stream
+static void song_transform_classify(song_event_store_t &store, song_transform_columns_t &col) {
+  uint count = store.size;
+
+  col.kind.assign(count, SONG_KIND_OTHER);
+  col.time.resize(count);
+  col.velocity.assign(count, 0);
+  col.key.assign(count, 0);
+  col.value.assign(count, 0);
+  col.scale.assign(count, 1);
+
+  for (uint i = 0; i < count; i++) {
+    song_event_t *e = event_store_at(store, i);
+    byte a = e->a;
+    byte b = e->b;
+    byte c = e->c;
+    byte d = e->d;
+
+    col.time[i] = e->time;
+
+    if (a == SM_SYSTEM) {
+      uint payload = 0;
+
+      switch (b) {
+       case SMS_KEY_EVENT:
+         col.kind[i] = d ? SONG_KIND_NOTE_ON : SONG_KIND_NOTE_OFF;
+         col.key[i] = 16 * 128 + c;
+         break;
+
+       case SMS_KEY_MAP:   payload = 1; break;
+       case SMS_KEY_LABEL: payload = (d + 3) / 4; break;
+       case SMS_KEY_COLOR: payload = 1; break;
+
+       case SMS_SETTINGS:
+         if (i + 1 < count) {
+           song_event_t *size = event_store_at(store, i + 1);
+           payload = 1 + (((size->a << 24) | (size->b << 16) | (size->c << 8) | size->d) + 3) / 4;
+         }
+         break;
+      }
+
+      for (; payload && i + 1 < count; payload--) {
+        i++;
+        col.time[i] = event_store_at(store, i)->time;
+        col.kind[i] = SONG_KIND_PAYLOAD;
+      }
+      continue;
+    }
+
+    // controller streams share the keep list of record thinning
+    int value;
+    int scale;
+
+    if (song_thin_classify(*e, &col.key[i], &value, &scale)) {
+      col.kind[i] = SONG_KIND_CONTROLLER;
+      col.value[i] = value;
+      col.scale[i] = scale;
+      continue;
+    }
+
+    switch (a) {
+     case SM_STOP:
+       col.kind[i] = SONG_KIND_STOP;
+       continue;
+
+     case SM_NOTE_ON:
+       col.kind[i] = SONG_KIND_NOTE_ON;
+       col.key[i] = (b & 0x0f) * 128 + (c & 0x7f);
+       col.velocity[i] = d;
+       continue;
+
+     case SM_NOTE_OFF:
+       col.kind[i] = SONG_KIND_NOTE_OFF;
+       col.key[i] = (b & 0x0f) * 128 + (c & 0x7f);
+       continue;
+    }
+
+    switch (a & SM_MIDI_MASK_MSG) {
+     case SM_MIDI_NOTEON:
+       col.kind[i] = c ? SONG_KIND_NOTE_ON : SONG_KIND_NOTE_OFF;
+       col.key[i] = (a & 0x0f) * 128 + (b & 0x7f);
+       col.velocity[i] = c;
+       break;
+
+     case SM_MIDI_NOTEOFF:
+       col.kind[i] = SONG_KIND_NOTE_OFF;
+       col.key[i] = (a & 0x0f) * 128 + (b & 0x7f);
+       break;
+    }
+  }
+}
+
+// move note times to grid and add random offsets
+static void song_transform_times(song_transform_columns_t &col, const song_transform_t &transform, uint &seed) {
+  uint grid = song_ms_to_tick(transform.grid > 0 ? transform.grid : 0);
+  int strength = transform.strength;
+  int humanize = song_ms_to_tick(transform.humanize > 0 ? transform.humanize : 0);
+  uint step = grid ? grid : 1;
+
+  std::vector<uint> on_time(SONG_TRANSFORM_NOTE_KEYS, 0);
+  std::vector<uint> on_source(SONG_TRANSFORM_NOTE_KEYS, 0);
+
+  uint count = col.time.size();
+  const byte *kind = count ? &col.kind[0] : NULL;
+  const ushort *key = count ? &col.key[0] : NULL;
+  uint *time = count ? &col.time[0] : NULL;
+
+  for (uint i = 0; i < count; i++) {
+    if (kind[i] != SONG_KIND_NOTE_ON && kind[i] != SONG_KIND_NOTE_OFF)
+      continue;
+
+    uint source = time[i];
+    int t = source;
+
+    if (grid) {
+      int target = (source + grid / 2) / grid * grid;
+      t += (target - t) * strength / 100;
+    }
+
+    if (humanize) {
+      seed = seed * 1103515245 + 12345;
+      t += (int)((seed >> 8) % (2 * humanize + 1)) - humanize;
+    }
+
+    if (t < 0)
+      t = 0;
+
+    // a note never ends before it starts
+    if (kind[i] == SONG_KIND_NOTE_ON) {
+      on_time[key[i]] = t;
+      on_source[key[i]] = source;
+    } else if (source > on_source[key[i]] && (uint)t <= on_time[key[i]]) {
+      t = on_time[key[i]] + step;
+    }
+
+    time[i] = t;
+  }
+}
+
+// map note on velocities through a curve
+static void song_transform_velocities(song_transform_columns_t &col, const song_transform_t &transform, uint &seed) {
+  byte curve[128];
+  double gamma = transform.velocity_curve > 0 ? transform.velocity_curve : 1;
+  int humanize = transform.humanize_velocity > 0 ? transform.humanize_velocity : 0;
+
+  for (int v = 0; v < 128; v++)
+    curve[v] = (byte)clamp_value((int)(pow(v / 127.0, gamma) * 127 + 0.5), 1, 127);
+
+  uint count = col.velocity.size();
+  const byte *kind = count ? &col.kind[0] : NULL;
+  byte *velocity = count ? &col.velocity[0] : NULL;
+
+  for (uint i = 0; i < count; i++) {
+    if (kind[i] != SONG_KIND_NOTE_ON)
+      continue;
+
+    int v = curve[velocity[i] & 0x7f];
+
+    if (humanize) {
+      seed = seed * 1103515245 + 12345;
+      v += (int)((seed >> 8) % (2 * humanize + 1)) - humanize;
+    }
+
+    velocity[i] = (byte)clamp_value(v, 1, 127);
+  }
+}
+
+// thin controller streams, at most one event per interval plus the last one of a burst
+static void song_transform_thin(song_transform_columns_t &col, const song_transform_t &transform) {
+  song_thin_t thin = { song_ms_to_tick(transform.thin), 0 };
+  const uint none = (uint)-1;
+
+  std::vector<song_thin_state_t> state(SONG_THIN_STREAMS);
+  std::vector<uint> held(SONG_THIN_STREAMS, none);
+
+  uint count = col.kind.size();
+
+  for (uint i = 0; i < count; i++) {
+    if (col.kind[i] != SONG_KIND_CONTROLLER)
+      continue;
+
+    ushort k = col.key[i];
+    int result = song_thin_check(state[k], thin, col.time[i], col.value[i], col.scale[i]);
+
+    if (held[k] != none && result != SONG_THIN_KEEP)
+      col.kind[held[k]] = SONG_KIND_DROPPED;
+    held[k] = none;
+
+    if (result == SONG_THIN_DROP)
+      col.kind[i] = SONG_KIND_DROPPED;
+    else if (result == SONG_THIN_HOLD)
+      held[k] = i;
+  }
+}
+
+// stable order by time
+static bool song_transform_before(const song_event_t &a, const song_event_t &b) {
+  return a.time < b.time;
+}
+
+// write columns back to track
+static void song_transform_apply(song_event_store_t &store, song_transform_columns_t &col) {
+  uint count = col.kind.size();
+  uint size = 0;
+  uint last = 0;
+  bool sorted = true;
+
+  // final stop is written after every event, quantize may move notes past it
+  uint final_stop = count;
+  for (uint i = count; i > 0; i--) {
+    if (col.kind[i - 1] == SONG_KIND_STOP) {
+      final_stop = i - 1;
+      break;
+    }
+  }
+
+  song_event_t stop = {0};
+  if (final_stop < count)
+    stop = *event_store_at(store, final_stop);
+
+  for (uint i = 0; i < count; i++) {
+    if (col.kind[i] == SONG_KIND_DROPPED || i == final_stop)
+      continue;
+
+    song_event_t e = *event_store_at(store, i);
+    e.time = col.time[i];
+
+    if (col.kind[i] == SONG_KIND_NOTE_ON) {
+      if (e.a == SM_NOTE_ON)
+        e.d = col.velocity[i];
+      else if ((e.a & SM_MIDI_MASK_MSG) == SM_MIDI_NOTEON)
+        e.c = col.velocity[i];
+    }
+
+    // stop stays at the end
+    if (col.kind[i] == SONG_KIND_STOP && e.time < last)
+      e.time = last;
+
+    if (e.time < last)
+      sorted = false;
+    else
+      last = e.time;
+
+    *event_store_at(store, size++) = e;
+  }
+
+  store.size = size;
+
+  if (!sorted) {
+    std::vector<song_event_t> events(size);
+    for (uint i = 0; i < size; i++)
+      events[i] = *event_store_at(store, i);
+
+    std::stable_sort(events.begin(), events.end(), song_transform_before);
+
+    for (uint i = 0; i < size; i++)
+      *event_store_at(store, i) = events[i];
+  }
+
+  if (final_stop < count) {
+    if (stop.time < last)
+      stop.time = last;
+
+    *event_store_at(store, size++) = stop;
+    store.size = size;
+  }
+}
+
+// transform recorded tracks
+int song_transform(const song_transform_t &transform) {
+  thread_lock lock(song_lock);
+
+  if (!song_opened || song_recording)
+    return -1;
+
+  song_stop_playback();
+  song_loader_wait();
+  song_loop_clear();
+  song_snapshot_clear();
+
+  uint seed = 1;
+  song_transform_columns_t col;
+
+  for (uint i = 0; i < song_track_count; i++) {
+    song_event_store_t &store = song_tracks[i].events;
+
+    song_transform_classify(store, col);
+
+    if (transform.grid > 0 || transform.humanize > 0)
+      song_transform_times(col, transform, seed);
+
+    if (transform.velocity_curve != 1 || transform.humanize_velocity > 0)
+      song_transform_velocities(col, transform, seed);
+
+    if (transform.thin > 0)
+      song_transform_thin(col, transform);
+
+    song_transform_apply(store, col);
+  }
 
-void song_trigger_sync(uint flags) {
-  thread_lock lock(song_lock);
-  sync_trigger |= flags;
+  song_snapshot_request();
+  return 0;
 }
 
 // -----------------------------------------------------------------------------------------
@@ -1114,11 +3516,475 @@ static void read_idp_string(char *buff, size_t buff_size, FILE *fp) {
   }
 }
 
+// input chunk size while inflating
+#define SONG_INFLATE_CHUNK        (64 * 1024)
+
+// feed next chunk of compressed data to inflate
+static void inflate_refill(z_stream &stream, byte *buffer, FILE *fp, uint &remain) {
+  if (stream.avail_in == 0 && remain) {
+    uint size = remain < SONG_INFLATE_CHUNK ? remain : SONG_INFLATE_CHUNK;
+    read(buffer, size, fp);
+    remain -= size;
+
+    stream.next_in = buffer;
+    stream.avail_in = size;
+  }
+}
+
+// inflate events from file to event store
+static void inflate_events(FILE *fp, uint size) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+
+  if (inflateInit(&stream) != Z_OK)
+    throw -1;
+
+  std::vector<byte> input(SONG_INFLATE_CHUNK);
+
+  int ret = Z_OK;
+  try {
+    while (ret == Z_OK) {
+      uint count;
+      song_event_t *tail = event_store_tail(song_events, &count);
+
+      // song too large, keep loaded events.
+      if (tail == NULL)
+        break;
+
+      inflate_refill(stream, &input[0], fp, size);
+
+      stream.next_out = (Bytef *)tail;
+      stream.avail_out = count * sizeof(song_event_t);
+
+      ret = inflate(&stream, Z_NO_FLUSH);
+      event_store_commit(song_events, count - stream.avail_out / sizeof(song_event_t));
+    }
+  } catch (int) {
+    inflateEnd(&stream);
+    throw;
+  }
+
+  inflateEnd(&stream);
+
+  if (ret != Z_STREAM_END && ret != Z_OK)
+    throw -1;
+}
+
+// inflate events saved with the legacy layout, converting them to ticks
+static void inflate_legacy_events(FILE *fp, uint size) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+
+  if (inflateInit(&stream) != Z_OK)
+    throw -1;
+
+  std::vector<byte> input(SONG_INFLATE_CHUNK);
+  song_event_legacy_t buffer[4096];
+  uint used = 0;
+
+  int ret = Z_OK;
+  try {
+    while (ret == Z_OK) {
+      inflate_refill(stream, &input[0], fp, size);
+
+      stream.next_out = (Bytef *)buffer + used;
+      stream.avail_out = sizeof(buffer) - used;
+
+      ret = inflate(&stream, Z_NO_FLUSH);
+      used = sizeof(buffer) - stream.avail_out;
+
+      // convert complete events
+      uint count = used / sizeof(song_event_legacy_t);
+      for (uint i = 0; i < count; i++) {
+        song_event_t *e = event_store_append(song_events);
+
+        // song too large, keep loaded events.
+        if (e == NULL) {
+          ret = Z_STREAM_END;
+          break;
+        }
+
+        e->time = song_ms_to_tick(buffer[i].time);
+        e->a = buffer[i].a;
+        e->b = buffer[i].b;
+        e->c = buffer[i].c;
+        e->d = buffer[i].d;
+      }
+
+      // keep partial event
+      used -= count * sizeof(song_event_legacy_t);
+      memmove(buffer, (byte *)buffer + count * sizeof(song_event_legacy_t), used);
+    }
+  } catch (int) {
+    inflateEnd(&stream);
+    throw;
+  }
+
+  inflateEnd(&stream);
+
+  if (ret != Z_STREAM_END && ret != Z_OK)
+    throw -1;
+}
+
+// -----------------------------------------------------------------------------------------
+// event blocks
+// -----------------------------------------------------------------------------------------
+// since 1.10 events are saved in independently compressed blocks, each event is stored
+// as a zigzag varint time delta followed by the message bytes. a block index with
+// the first event time and a crc32 of every block is written before the block data.
+// the index gives the song length before the blocks are read and lets a damaged block
+// end loading early. blocks are decoded in order by one loader thread: playback reads
+// the store while it grows, so blocks can only be committed in order, and seeking
+// restores snapshots taken by a replay, which needs every block before it anyway.
+#define SONG_BLOCK_EVENTS         4096
+#define SONG_BLOCK_MAX_SIZE       (SONG_BLOCK_EVENTS * 9)
+
+struct song_block_t {
+  uint time;
+  uint event_count;
+  uint offset;
+  uint size;
+  uint crc;
+};
+
+// write varint
+static inline byte* write_varint(byte *p, uint value) {
+  while (value >= 0x80) {
+    *p++ = (byte)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (byte)value;
+  return p;
+}
+
+// read varint
+static inline const byte* read_varint(const byte *p, const byte *end, uint *value) {
+  uint result = 0;
+
+  for (uint shift = 0; shift < 32; shift += 7) {
+    if (p >= end)
+      throw -1;
+
+    byte b = *p++;
+    result |= (uint)(b & 0x7f) << shift;
+
+    if ((b & 0x80) == 0) {
+      *value = result;
+      return p;
+    }
+  }
+  throw -1;
+}
+
+// encode a block, returns raw size
+static uint encode_event_block(byte *buffer, song_event_store_t &store, uint first, uint count) {
+  byte *p = buffer;
+  uint time = event_store_at(store, first)->time;
+
+  for (uint i = first; i < first + count; i++) {
+    song_event_t *e = event_store_at(store, i);
+    int delta = (int)(e->time - time);
+
+    p = write_varint(p, ((uint)delta << 1) ^ (uint)(delta >> 31));
+    p[0] = e->a;
+    p[1] = e->b;
+    p[2] = e->c;
+    p[3] = e->d;
+    p += 4;
+
+    time = e->time;
+  }
+
+  return p - buffer;
+}
+
+// decode a block
+static void decode_event_block(const byte *buffer, uint size, const song_block_t &block, song_event_t *events) {
+  const byte *p = buffer;
+  const byte *end = buffer + size;
+  uint time = block.time;
+
+  for (uint i = 0; i < block.event_count; i++) {
+    uint zigzag;
+    p = read_varint(p, end, &zigzag);
+
+    if (p + 4 > end)
+      throw -1;
+
+    song_event_t *e = &events[i];
+    time += (uint)((int)(zigzag >> 1) ^ -(int)(zigzag & 1));
+    e->time = time;
+    e->a = p[0];
+    e->b = p[1];
+    e->c = p[2];
+    e->d = p[3];
+    p += 4;
+  }
+
+  // block holds more events than its index says
+  if (p != end)
+    throw -1;
+}
+
+// append decoded events to event store
+static void append_events(song_event_store_t &store, const song_event_t *events, uint count) {
+  while (count) {
+    uint space;
+    song_event_t *tail = event_store_tail(store, &space);
+
+    // song too large, keep loaded events.
+    if (tail == NULL)
+      break;
+
+    if (space > count)
+      space = count;
+
+    memcpy(tail, events, space * sizeof(song_event_t));
+    event_store_commit(store, space);
+
+    events += space;
+    count -= space;
+  }
+}
+
+// buffers used while loading blocks
+struct song_block_buffer_t {
+  std::vector<byte> raw;
+  std::vector<byte> compressed;
+  std::vector<song_event_t> events;
+  long file_size;
+
+  song_block_buffer_t()
+    : raw(SONG_BLOCK_MAX_SIZE)
+    , compressed(compressBound(SONG_BLOCK_MAX_SIZE))
+    , events(SONG_BLOCK_EVENTS)
+    , file_size(-1) {}
+};
+
+// read, check and decode a block into store
+static void load_event_block(FILE *fp, long data_position, const song_block_t &block, song_event_store_t &store, song_block_buffer_t &buffer, song_settings_scan_t &scan) {
+  std::vector<byte> &raw = buffer.raw;
+  std::vector<byte> &compressed = buffer.compressed;
+  std::vector<song_event_t> &events = buffer.events;
+
+  if (block.event_count > SONG_BLOCK_EVENTS)
+    throw -1;
+
+  // sizes come from the file, never allocate for them
+  if (block.size > compressed.size())
+    throw -1;
+
+  if (buffer.file_size < 0) {
+    long position = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    buffer.file_size = ftell(fp);
+    fseek(fp, position, SEEK_SET);
+  }
+
+  if (block.offset > (uint)(buffer.file_size - data_position) ||
+      block.size > (uint)(buffer.file_size - data_position) - block.offset)
+    throw -1;
+
+  // blocks are contiguous, seek only when they are not
+  if (block.offset != ftell(fp) - data_position)
+    fseek(fp, data_position + block.offset, SEEK_SET);
+
+  read(&compressed[0], block.size, fp);
+
+  if (crc32(crc32(0, Z_NULL, 0), &compressed[0], block.size) != block.crc)
+    throw -1;
+
+  uLongf raw_size = raw.size();
+  if (uncompress(&raw[0], &raw_size, &compressed[0], block.size) != Z_OK)
+    throw -1;
+
+  decode_event_block(&raw[0], raw_size, block, &events[0]);
+  song_settings_scan(scan, &events[0], block.event_count);
+  append_events(store, &events[0], block.event_count);
+}
+
+// read block index, returns position of block data
+static long read_event_block_index(FILE *fp, std::vector<song_block_t> &blocks) {
+  uint block_count;
+  uint event_count;
+
+  read(&block_count, sizeof(block_count), fp);
+  read(&event_count, sizeof(event_count), fp);
+
+  if (block_count > (song_event_capacity + SONG_BLOCK_EVENTS - 1) / SONG_BLOCK_EVENTS)
+    throw -1;
+
+  if (event_count > song_event_capacity)
+    throw -1;
+
+  blocks.resize(block_count);
+  if (block_count)
+    read(&blocks[0], block_count * sizeof(song_block_t), fp);
+
+  // event counts of blocks must add up to the track
+  uint total = 0;
+  for (uint i = 0; i < block_count; i++) {
+    if (blocks[i].event_count > SONG_BLOCK_EVENTS)
+      throw -1;
+    total += blocks[i].event_count;
+  }
+
+  if (total != event_count)
+    throw -1;
+
+  return ftell(fp);
+}
+
+// load all blocks of a track in place
+static void load_event_blocks(FILE *fp, song_event_store_t &store, song_settings_t *settings) {
+  std::vector<song_block_t> blocks;
+  long data_position = read_event_block_index(fp, blocks);
+  song_block_buffer_t buffer;
+  song_settings_scan_t scan(settings);
+
+  event_store_reset(store);
+
+  for (uint i = 0; i < blocks.size(); i++)
+    load_event_block(fp, data_position, blocks[i], store, buffer, scan);
+}
+
+// save event blocks
+static void save_event_blocks(FILE *fp, song_event_store_t &store) {
+  uint block_count = (store.size + SONG_BLOCK_EVENTS - 1) / SONG_BLOCK_EVENTS;
+
+  std::vector<song_block_t> blocks(block_count);
+  std::vector<byte> raw(SONG_BLOCK_MAX_SIZE);
+  std::vector<byte> compressed(compressBound(SONG_BLOCK_MAX_SIZE));
+
+  write(&block_count, sizeof(block_count), fp);
+  write((const void *)&store.size, sizeof(store.size), fp);
+
+  // reserve block index, write it back when done
+  long index_position = ftell(fp);
+  if (block_count)
+    write(&blocks[0], block_count * sizeof(song_block_t), fp);
+
+  uint offset = 0;
+
+  for (uint i = 0; i < block_count; i++) {
+    song_block_t &block = blocks[i];
+    uint first = i * SONG_BLOCK_EVENTS;
+
+    block.time = event_store_at(store, first)->time;
+    block.event_count = store.size - first;
+    if (block.event_count > SONG_BLOCK_EVENTS)
+      block.event_count = SONG_BLOCK_EVENTS;
+
+    uint raw_size = encode_event_block(&raw[0], store, first, block.event_count);
+
+    uLongf size = compressed.size();
+    if (compress(&compressed[0], &size, &raw[0], raw_size) != Z_OK)
+      throw -1;
+
+    block.offset = offset;
+    block.size = size;
+    block.crc = crc32(crc32(0, Z_NULL, 0), &compressed[0], size);
+
+    write(&compressed[0], size, fp);
+    offset += size;
+  }
+
+  // write block index
+  if (block_count) {
+    long end_position = ftell(fp);
+    fseek(fp, index_position, SEEK_SET);
+    write(&blocks[0], block_count * sizeof(song_block_t), fp);
+    fseek(fp, end_position, SEEK_SET);
+  }
+}
+
+// -----------------------------------------------------------------------------------------
+// background loader
+// -----------------------------------------------------------------------------------------
+// blocks are decoded on a loader thread, playback can start with the first events and
+// waits at the end of loaded events until the loader is done. the loader never takes
+// the song lock, anything else modifying the event store stops or waits for it first.
+static HANDLE song_loader_thread = NULL;
+static FILE *song_loader_file = NULL;
+static std::vector<song_block_t> song_loader_blocks;
+static long song_loader_data_position = 0;
+static volatile bool song_loader_abort = false;
+static volatile uint song_load_progress = 100;
+
+// loader thread
+static DWORD __stdcall song_loader_proc(void *param) {
+  FILE *fp = song_loader_file;
+  song_block_buffer_t buffer;
+  song_settings_scan_t scan(song_settings);
+
+  try {
+    for (uint i = 0; i < song_loader_blocks.size() && !song_loader_abort; i++) {
+      load_event_block(fp, song_loader_data_position, song_loader_blocks[i], song_events, buffer, scan);
+
+      song_load_progress = (i + 1) * 100 / song_loader_blocks.size();
+    }
+  } catch (int) {
+    // damaged block, keep loaded events.
+  }
+
+  fclose(fp);
+  song_load_progress = 100;
+  song_loading = false;
+
+  // seek index waits for the complete song
+  song_worker_signal();
+  return 0;
+}
+
+// read block index and start loading, returns true when the loader owns the file
+static bool song_loader_start(FILE *fp) {
+  song_loader_data_position = read_event_block_index(fp, song_loader_blocks);
+
+  if (song_loader_blocks.empty())
+    return false;
+
+  song_loader_file = fp;
+  song_loading_length = song_loader_blocks.back().time;
+  song_loader_abort = false;
+  song_load_progress = 0;
+  song_loading = true;
+
+  song_loader_thread = CreateThread(NULL, 0, &song_loader_proc, NULL, NULL, NULL);
+
+  // load in place when thread is not available
+  if (song_loader_thread == NULL)
+    song_loader_proc(NULL);
+
+  return true;
+}
+
+// wait loader to finish
+static void song_loader_wait() {
+  if (song_loader_thread) {
+    WaitForSingleObject(song_loader_thread, -1);
+    CloseHandle(song_loader_thread);
+    song_loader_thread = NULL;
+  }
+  song_loader_blocks.clear();
+}
+
+// stop loader
+static void song_loader_stop() {
+  song_loader_abort = true;
+  song_loader_wait();
+  song_loader_abort = false;
+}
+
+// get load progress
+int song_get_load_progress() {
+  return song_load_progress;
+}
+
 // open lyt
-int song_open_lyt(const char *filename) {
+static int song_open_lyt_file(const char *filename) {
   thread_lock lock(song_lock);
 
-  song_close();
+  song_close_file();
 
   FILE *fp = fopen(filename, "rb");
   try {
@@ -1332,33 +4198,299 @@ int song_open_lyt(const char *filename) {
       byte type;
       int key;
 
-      read(&time, sizeof(time), fp);
-      read(&unknown, sizeof(unknown), fp);
+      read(&time, sizeof(time), fp);
+      read(&unknown, sizeof(unknown), fp);
+
+      read(&type, sizeof(type), fp);
+      read(&key, sizeof(key), fp);
+
+      switch (type) {
+       case 1: song_add_event(time, SM_SYSTEM, SMS_KEY_EVENT, key, 1); break;      // keydown
+       case 2: song_add_event(time, SM_SYSTEM, SMS_KEY_EVENT, key, 0); break;      // keyup
+       case 3: song_add_event(time, SM_OCTAVE, 1, SM_VALUE_SET, key); break;       // set oct shift
+       case 4: song_add_event(time, SM_OCTAVE, 0, SM_VALUE_SET, key); break;       // set oct shift
+       case 5: song_add_event(time, SM_KEY_SIGNATURE, SM_VALUE_SET, key, 0); break;// set midi oct shift
+       case 18:    break;      // drum
+       case 19:    break;      // maybe song end.
+       default:
+         printf("unknown type : %d\t%d\t%d\n", time, type, key);
+      }
+    }
+
+    song_recording = false;
+    fclose(fp);
+
+    // mark song protected
+    song_info.write_protected = true;
+
+    // build seek index
+    song_snapshot_request();
+  } catch (int err) {
+    song_close_file();
+    fclose(fp);
+    return err;
+  }
+
+  return 0;
+}
+
+// midi file track reader
+struct midi_track_t {
+  const byte *pos;
+  const byte *end;
+  uint tick;
+  byte status;
+  int index;
+};
+
+// read variable length quantity
+static uint midi_read_vlq(const byte *&pos, const byte *end) {
+  uint value = 0;
+
+  for (int i = 0; i < 4; i++) {
+    if (pos >= end)
+      throw -1;
+
+    byte b = *pos++;
+    value = (value << 7) | (b & 0x7f);
+    if ((b & 0x80) == 0)
+      return value;
+  }
+  throw -1;
+}
+
+// read big endian integer
+static uint midi_read_be(const byte *pos, int size) {
+  uint value = 0;
+  for (int i = 0; i < size; i++)
+    value = (value << 8) | pos[i];
+  return value;
+}
+
+// advance track to next event, returns false at end of track
+static bool midi_track_advance(midi_track_t &track) {
+  if (track.pos >= track.end)
+    return false;
+
+  track.tick += midi_read_vlq(track.pos, track.end);
+  return true;
+}
+
+// heap order: earliest tick first, lower track first on ties
+struct midi_track_order {
+  const midi_track_t *tracks;
+  bool operator () (int a, int b) const {
+    if (tracks[a].tick != tracks[b].tick)
+      return tracks[a].tick > tracks[b].tick;
+    return a > b;
+  }
+};
+
+// open midi file
+static int song_open_midi_file(const char *filename) {
+  thread_lock lock(song_lock);
+
+  song_close_file();
+
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return -1;
+
+  std::vector<byte> data;
+  std::vector<midi_track_t> tracks;
+  std::vector<int> heap;
+
+  try {
+    // read whole file
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (size < 14)
+      throw -1;
+
+    data.resize(size);
+    read(&data[0], size, fp);
+    fclose(fp);
+    fp = NULL;
+
+    const byte *pos = &data[0];
+    const byte *end = pos + size;
+
+    // header chunk
+    if (memcmp(pos, "MThd", 4) != 0)
+      throw -1;
+
+    uint header_size = midi_read_be(pos + 4, 4);
+    if (header_size < 6 || header_size > (uint)(end - pos - 8))
+      throw -1;
+
+    uint format = midi_read_be(pos + 8, 2);
+    uint track_count = midi_read_be(pos + 10, 2);
+    uint division = midi_read_be(pos + 12, 2);
+
+    if (format > 1 || division == 0)
+      throw -1;
+
+    pos += 8 + header_size;
+
+    // collect track chunks, skipping unknown chunks
+    while (end - pos >= 8 && tracks.size() < track_count) {
+      uint chunk_size = midi_read_be(pos + 4, 4);
+      const byte *chunk = pos + 8;
+
+      if (chunk_size > (uint)(end - chunk))
+        chunk_size = end - chunk;
+
+      if (memcmp(pos, "MTrk", 4) == 0) {
+        midi_track_t track;
+        track.pos = chunk;
+        track.end = chunk + chunk_size;
+        track.tick = 0;
+        track.status = 0;
+        track.index = tracks.size();
+        tracks.push_back(track);
+      }
+
+      pos = chunk + chunk_size;
+    }
+
+    if (tracks.empty())
+      throw -1;
+
+    // tick to time conversion
+    double ms_per_tick;
+    bool smpte = (division & 0x8000) != 0;
+    uint tempo = 500000;
+    uint tempo_tick = 0;
+    double tempo_time = 0;
+
+    if (smpte) {
+      int fps = -(char)(division >> 8);
+      int ticks_per_frame = division & 0xff;
+      if (fps <= 0 || ticks_per_frame == 0)
+        throw -1;
+      ms_per_tick = 1000.0 / (fps * ticks_per_frame);
+    } else {
+      ms_per_tick = tempo / 1000.0 / division;
+    }
+
+    // start record
+    song_init_record();
+
+    const char *name = PathFindFileName(filename);
+    strncpy(song_info.title, name, sizeof(song_info.title) - 1);
+    PathRemoveExtension(song_info.title);
+
+    // prime the merge heap with the first event of every track
+    midi_track_order order = { &tracks[0] };
+    for (size_t i = 0; i < tracks.size(); i++) {
+      if (midi_track_advance(tracks[i]))
+        heap.push_back(i);
+    }
+    std::make_heap(heap.begin(), heap.end(), order);
+
+    double time = 0;
+
+    while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), order);
+      midi_track_t &track = tracks[heap.back()];
 
-      read(&type, sizeof(type), fp);
-      read(&key, sizeof(key), fp);
+      time = tempo_time + (track.tick - tempo_tick) * ms_per_tick;
 
-      switch (type) {
-       case 1: song_add_event(time, SM_SYSTEM, SMS_KEY_EVENT, key, 1); break;      // keydown
-       case 2: song_add_event(time, SM_SYSTEM, SMS_KEY_EVENT, key, 0); break;      // keyup
-       case 3: song_add_event(time, SM_OCTAVE, 1, SM_VALUE_SET, key); break;       // set oct shift
-       case 4: song_add_event(time, SM_OCTAVE, 0, SM_VALUE_SET, key); break;       // set oct shift
-       case 5: song_add_event(time, SM_KEY_SIGNATURE, SM_VALUE_SET, key, 0); break;// set midi oct shift
-       case 18:    break;      // drum
-       case 19:    break;      // maybe song end.
-       default:
-         printf("unknown type : %d\t%d\t%d\n", time, type, key);
+      if (track.pos >= track.end)
+        throw -1;
+
+      byte status = *track.pos;
+      bool track_end = false;
+
+      if (status & 0x80) {
+        track.pos++;
+      } else {
+        // running status
+        status = track.status;
+        if (status == 0)
+          throw -1;
       }
+
+      if (status == 0xff) {
+        // meta event
+        if (track.pos >= track.end)
+          throw -1;
+
+        byte type = *track.pos++;
+        uint length = midi_read_vlq(track.pos, track.end);
+        if (length > (uint)(track.end - track.pos))
+          throw -1;
+
+        switch (type) {
+         case 0x03:  // track name
+           if (track.index == 0 && length) {
+             uint copy = length < sizeof(song_info.title) ? length : sizeof(song_info.title) - 1;
+             memcpy(song_info.title, track.pos, copy);
+             song_info.title[copy] = 0;
+           }
+           break;
+
+         case 0x2f:  // end of track
+           track_end = true;
+           break;
+
+         case 0x51:  // set tempo
+           if (length == 3 && !smpte) {
+             tempo_time = time;
+             tempo_tick = track.tick;
+             tempo = midi_read_be(track.pos, 3);
+             ms_per_tick = tempo / 1000.0 / division;
+           }
+           break;
+        }
+
+        track.pos += length;
+        track.status = 0;
+      } else if (status == 0xf0 || status == 0xf7) {
+        // sysex is skipped
+        uint length = midi_read_vlq(track.pos, track.end);
+        if (length > (uint)(track.end - track.pos))
+          throw -1;
+
+        track.pos += length;
+        track.status = 0;
+      } else if (status < 0xf0) {
+        // channel message
+        byte op = status & SM_MIDI_MASK_MSG;
+        int data_size = (op == SM_MIDI_PROGRAM || op == SM_MIDI_CHANNEL_PRESSURE) ? 1 : 2;
+
+        if (data_size > track.end - track.pos)
+          throw -1;
+
+        byte b = track.pos[0] & 0x7f;
+        byte c = data_size > 1 ? track.pos[1] & 0x7f : 0;
+
+        track.pos += data_size;
+        track.status = status;
+
+        song_add_event(time, status, b, c, 0);
+      } else {
+        // system common messages are not expected in files
+        throw -1;
+      }
+
+      if (!track_end && midi_track_advance(track))
+        std::push_heap(heap.begin(), heap.end(), order);
+      else
+        heap.pop_back();
     }
 
-    record_position = NULL;
-    fclose(fp);
+    song_add_event(time, SM_STOP, 0, 0, 0);
+    song_recording = false;
 
-    // mark song protected
-    song_info.write_protected = true;
+    // build seek index
+    song_snapshot_request();
   } catch (int err) {
-    song_end = NULL;
-    fclose(fp);
+    song_close_file();
+    if (fp)
+      fclose(fp);
     return err;
   }
 
@@ -1367,12 +4499,22 @@ int song_open_lyt(const char *filename) {
 
 
 // close
-void song_close() {
+static void song_close_file() {
   thread_lock lock(song_lock);
 
   song_stop_record();
   song_stop_playback();
-  song_end = NULL;
+  song_loader_stop();
+  song_journal_discard();
+  song_snapshot_clear();
+  song_loop_clear();
+  for (uint i = 0; i < SONG_TRACK_MAX; i++)
+    event_store_free(song_tracks[i].events);
+  song_settings_clear(song_settings);
+  song_track_count = 0;
+  play_heap_size = 0;
+  play_base_waiting = false;
+  song_opened = false;
 }
 
 
@@ -1380,10 +4522,9 @@ void song_close() {
 static void check_compatibility() {
   // upgrade from 1.7 to 1.8
   if (song_info.version <= 0x01070000) {
-    song_event_t *e;
-
     // foreach event
-    for (e = song_event_buffer; e < song_end; e++) {
+    for (uint i = 0; i < song_events.size; i++) {
+      song_event_t *e = event_store_at(song_events, i);
       byte a = e->a;
       byte b = e->b;
       byte c = e->c;
@@ -1391,10 +4532,10 @@ static void check_compatibility() {
 
       if (a == SM_SYSTEM) {
         if (b == SMS_KEY_LABEL) {
-          e += (d + 3) / 4;
+          i += (d + 3) / 4;
         }
         else if (b == SMS_KEY_COLOR) {
-          e ++;
+          i ++;
         }
       }
 
@@ -1452,10 +4593,10 @@ static void check_compatibility() {
 }
 
 // open song
-int song_open(const char *filename) {
+static int song_open_file(const char *filename) {
   thread_lock lock(song_lock);
 
-  song_close();
+  song_close_file();
 
   FILE *fp = fopen(filename, "rb");
 
@@ -1488,22 +4629,35 @@ int song_open(const char *filename) {
     read_string(instrument, sizeof(instrument), fp);
 
 
-    // read events
-    uint temp_size;
-    read(&temp_size, sizeof(temp_size), fp);
-    byte *temp_buffer = new byte[temp_size];
+    // read events, saved in blocks since 1.10
+    if (song_info.version >= 0x010a0000) {
+      // overdub tracks since 1.11, they are stored before the base track
+      if (song_info.version >= 0x010b0000) {
+        read(&song_track_count, sizeof(song_track_count), fp);
+        if (song_track_count < 1 || song_track_count > SONG_TRACK_MAX)
+          throw -1;
 
-    read(temp_buffer, temp_size, fp);
+        for (uint i = 1; i < song_track_count; i++)
+          load_event_blocks(fp, song_tracks[i].events, song_settings);
+      }
 
-    uint data_size = sizeof(song_event_buffer);
-    uncompress((byte *)song_event_buffer, (uLongf *)&data_size, (Bytef *)temp_buffer, temp_size);
+      // base track is decoded in background, the loader owns the file now
+      if (song_loader_start(fp))
+        fp = NULL;
+    } else {
+      uint temp_size;
+      read(&temp_size, sizeof(temp_size), fp);
 
-    song_end = record_position = song_event_buffer + data_size / sizeof(song_event_t);
+      // events are packed since 1.9
+      if (song_info.version <= 0x01080000)
+        inflate_legacy_events(fp, temp_size);
+      else
+        inflate_events(fp, temp_size);
+    }
 
-    record_position = NULL;
+    song_recording = false;
 
-    delete[] temp_buffer;
-    fclose(fp);
+    if (fp) fclose(fp);
 
     // mark song protected
     song_info.write_protected = true;
@@ -1511,9 +4665,12 @@ int song_open(const char *filename) {
     // check compatibility and perhaps upgrade to lastest version.
     check_compatibility();
 
+    // build seek index, songs still loading build it when the loader is done
+    song_snapshot_request();
+
     return 0;
   } catch (int err) {
-    song_end = NULL;
+    song_close_file();
     if (fp) fclose(fp);
     return err;
   }
@@ -1525,8 +4682,9 @@ int song_save(const char *filename) {
   thread_lock lock(song_lock);
 
   song_stop_record();
+  song_loader_wait();
 
-  if (song_end) {
+  if (song_opened) {
     FILE *fp = fopen(filename, "wb");
     if (!fp)
       return -1;
@@ -1551,18 +4709,17 @@ int song_save(const char *filename) {
         write_string(buff, fp);
       }
 
-      // write events
-      uint temp_size = sizeof(song_event_buffer);
-      byte *temp_buffer = new byte[temp_size];
+      // write overdub tracks, then the base track
+      write(&song_track_count, sizeof(song_track_count), fp);
+      for (uint i = 1; i < song_track_count; i++)
+        save_event_blocks(fp, song_tracks[i].events);
 
-      compress((Bytef *)temp_buffer, (uLongf *)&temp_size, (byte *)song_event_buffer, (song_end - song_event_buffer) * sizeof(song_event_t));
-
-      write(&temp_size, sizeof(temp_size), fp);
-      write(temp_buffer, temp_size, fp);
-
-      delete[] temp_buffer;
+      save_event_blocks(fp, song_events);
 
       fclose(fp);
+
+      // saved song no longer needs the journal
+      song_journal_discard();
       return 0;
     } catch (int err) {
       fclose(fp);
@@ -1570,4 +4727,637 @@ int song_save(const char *filename) {
     }
   }
   return -1;
+}
+
+// recover unsaved recording from journal
+int song_recover() {
+  song_playlist_stop();
+
+  thread_lock lock(song_lock);
+
+  char path[MAX_PATH];
+  song_journal_path(path, sizeof(path));
+
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return -1;
+
+  std::vector<song_event_t> tracks[SONG_TRACK_MAX];
+  char magic[sizeof(song_journal_magic)];
+  uint version = 0;
+  uint track = 0;
+  bool base = true;
+
+  if (fread(magic, sizeof(magic), 1, fp) == 1 &&
+      fread(&version, sizeof(version), 1, fp) == 1 &&
+      memcmp(magic, song_journal_magic, sizeof(magic)) == 0 &&
+      version == current_version) {
+    song_event_t e;
+
+    // a journal started by an overdub of a loaded song begins with a track switch,
+    // the song it was recorded over is not part of it.
+    if (fread(&e, sizeof(e), 1, fp) == 1) {
+      base = e.time != SONG_JOURNAL_TRACK;
+      fseek(fp, -(long)sizeof(e), SEEK_CUR);
+    }
+
+    // a torn event at the end is ignored
+    while (fread(&e, sizeof(e), 1, fp) == 1) {
+      if (e.time == SONG_JOURNAL_TRACK)
+        track = e.a < SONG_TRACK_MAX ? e.a : 0;
+      else
+        tracks[track].push_back(e);
+    }
+  }
+  fclose(fp);
+
+  // overdub alone can not be recovered, it would replace the song as track 0
+  if (!base) {
+    DeleteFile(path);
+    return -1;
+  }
+
+  song_close_file();
+  song_init_record();
+  song_recording = false;
+  song_track_count = 0;
+
+  // tracks of a discarded song are dropped from the journal, keep the order of the rest
+  for (uint i = 0; i < SONG_TRACK_MAX; i++) {
+    std::vector<song_event_t> &events = tracks[i];
+    song_settings_scan_t scan(song_settings);
+
+    if (events.empty())
+      continue;
+
+    song_settings_scan(scan, &events[0], events.size());
+
+    if (events.back().a != SM_STOP) {
+      song_event_t stop = { events.back().time, SM_STOP, 0, 0, 0 };
+      events.push_back(stop);
+    }
+
+    append_events(song_tracks[song_track_count++].events, &events[0], events.size());
+  }
+
+  if (song_track_count == 0) {
+    song_close_file();
+    DeleteFile(path);
+    return -1;
+  }
+
+  // journal is kept until the recovered song is saved or closed
+  song_journal_owned = true;
+  song_snapshot_request();
+  return 0;
+}
+
+// start background work of songs
+int song_init() {
+  song_worker_start();
+  return 0;
+}
+
+// close song and finish journal before exit
+void song_shutdown() {
+  song_playlist_stop();
+  song_close_file();
+  song_journal_flush();
+}
+
+// midi file export
+#define SONG_MIDI_DIVISION        1000
+#define SONG_MIDI_TEMPO           500000
+#define SONG_MIDI_STEP            1.0
+
+// writes captured output as a single delta-timed track to memory
+struct song_midi_writer_t : midi_output_callback {
+  std::vector<byte> data;
+  uint time;
+  byte status;
+
+  void put(const void *buff, size_t size) {
+    data.insert(data.end(), (const byte *)buff, (const byte *)buff + size);
+  }
+
+  void put_vlq(uint value) {
+    byte buff[5];
+    int pos = sizeof(buff);
+
+    buff[--pos] = value & 0x7f;
+    while (value >>= 7)
+      buff[--pos] = 0x80 | (value & 0x7f);
+
+    put(buff + pos, sizeof(buff) - pos);
+  }
+
+  void put_delta() {
+    uint now = (uint)(song_timer * SONG_MIDI_DIVISION * 1000 / SONG_MIDI_TEMPO + 0.5);
+    put_vlq(now > time ? now - time : 0);
+    if (now > time)
+      time = now;
+  }
+
+  void put_meta(byte type, const void *data, uint size) {
+    byte head[2] = { 0xff, type };
+
+    put_delta();
+    put(head, sizeof(head));
+    put_vlq(size);
+    put(data, size);
+    status = 0;
+  }
+
+  void operator () (byte a, byte b, byte c, byte d) {
+    if (a < SM_MIDI_MESSAGE_START || a >= SM_MIDI_SYSEX)
+      return;
+
+    byte op = a & SM_MIDI_MASK_MSG;
+    byte data[3] = { a, b & 0x7f, c & 0x7f };
+    int size = (op == SM_MIDI_PROGRAM || op == SM_MIDI_CHANNEL_PRESSURE) ? 2 : 3;
+
+    put_delta();
+
+    // running status
+    if (a == status)
+      put(data + 1, size - 1);
+    else
+      put(data, size);
+
+    status = a;
+  }
+};
+
+// write big endian integer
+static void write_be(uint value, int size, FILE *fp) {
+  byte buff[4];
+  for (int i = 0; i < size; i++)
+    buff[i] = value >> ((size - 1 - i) * 8);
+  write(buff, size, fp);
+}
+
+// advance export clock in small steps, so timers behave as during playback
+static void song_export_advance(uint tick) {
+  double target = song_tick_to_ms(tick);
+
+  while (song_timer < target) {
+    double step = target - song_timer;
+    if (step > SONG_MIDI_STEP)
+      step = SONG_MIDI_STEP;
+
+    song_timer += step;
+    song_tick = song_ms_to_tick(song_timer);
+
+    keyboard_update(step);
+    sync_event_update(step);
+    delay_event_update(step);
+    pitch_update(step);
+  }
+}
+
+// save song as standard midi file
+int song_save_midi(const char *filename) {
+  song_midi_writer_t writer;
+  writer.time = 0;
+  writer.status = 0;
+
+  // the replay drives the shared playback engine and stays under the song lock,
+  // the track is captured to memory and written after the lock is released.
+  {
+    thread_lock lock(song_lock);
+
+    song_stop_record();
+    song_loader_wait();
+
+    if (!song_opened)
+      return -1;
+
+    song_replay_state_t state;
+    song_replay_begin(state);
+
+    byte tempo[3] = { SONG_MIDI_TEMPO >> 16, (SONG_MIDI_TEMPO >> 8) & 0xff, SONG_MIDI_TEMPO & 0xff };
+    writer.put_meta(0x51, tempo, sizeof(tempo));
+    if (song_info.title[0])
+      writer.put_meta(0x03, song_info.title, strlen(song_info.title));
+
+    // clear note state before capturing, the reset is not part of the song
+    midi_reset();
+
+    // replay song through the same event translation used by playback, output is
+    // muted like a seek and only the capture receives events
+    midi_set_output_capture(&writer);
+
+    while (song_event_t *e = play_position_peek()) {
+      song_export_advance(e->time);
+
+      if (e->a != SM_STOP)
+        song_send_event(e->a, e->b, e->c, e->d);
+      else if (play_position_tracks() == 1)
+        break;
+
+      play_position_next();
+    }
+
+    // release holding notes
+    for (int ch = 0; ch < 16; ch++) {
+      for (int note = 0; note < 128; note++) {
+        if (midi_get_note_status(ch, note))
+          writer(SM_MIDI_NOTEOFF | ch, note, 0, 0);
+      }
+    }
+
+    // end of track
+    writer.put_meta(0x2f, NULL, 0);
+
+    midi_set_output_capture(NULL);
+    song_replay_end(state);
+  }
+
+  FILE *fp = fopen(filename, "wb");
+  if (!fp)
+    return -1;
+
+  try {
+    // header chunk
+    write("MThd", 4, fp);
+    write_be(6, 4, fp);
+    write_be(0, 2, fp);
+    write_be(1, 2, fp);
+    write_be(SONG_MIDI_DIVISION, 2, fp);
+
+    // track chunk
+    write("MTrk", 4, fp);
+    write_be(writer.data.size(), 4, fp);
+    write(&writer.data[0], writer.data.size(), fp);
+
+    fclose(fp);
+    return 0;
+  } catch (int err) {
+    fclose(fp);
+    return err;
+  }
+}
+
+// -----------------------------------------------------------------------------------------
+// playlist
+// -----------------------------------------------------------------------------------------
+// a worker thread decodes the song after the current one into a second set of tracks
+// while the current one plays. when the current song reaches its stop event, song_update
+// exchanges the tracks and keeps playing from the same sample, without stopping playback
+// or resetting midi. songs that can't be preloaded (old formats, lyt and midi files) are
+// opened by the worker once the current song has stopped. everything that blocks,
+// allocates or frees is done by the worker, the audio thread only exchanges prepared
+// tracks and setting groups.
+
+enum song_next_state_t {
+  SONG_NEXT_EMPTY,
+  SONG_NEXT_LOADING,
+  SONG_NEXT_READY,
+  SONG_NEXT_FAILED,
+  SONG_NEXT_INSTALLED,
+};
+
+static std::vector<std::string> song_playlist;
+static uint song_playlist_index = 0;
+static bool song_playlist_repeat = false;
+static volatile bool song_playlist_running = false;
+static volatile bool song_playlist_ended = false;
+static HANDLE song_playlist_thread = NULL;
+static HANDLE song_playlist_wake = NULL;
+
+// next song, owned by the worker until it is ready
+static song_track_t song_next_tracks[SONG_TRACK_MAX];
+static uint song_next_track_count = 0;
+static song_info_t song_next_info;
+static uint song_next_index = 0;
+static config_prepared_t *song_next_config = NULL;
+static volatile LONG song_next_state = SONG_NEXT_EMPTY;
+
+// snapshots of the previous song, freed by the worker
+static std::vector<song_snapshot_t> song_next_stale_snapshots;
+
+// exchange contents of two stores
+static void event_store_swap(song_event_store_t &a, song_event_store_t &b) {
+  song_event_t **chunks = a.chunks;
+  uint chunk_count = a.chunk_count;
+  uint size = a.size;
+
+  a.chunks = b.chunks;
+  a.chunk_count = b.chunk_count;
+  a.size = b.size;
+  b.chunks = chunks;
+  b.chunk_count = chunk_count;
+  b.size = size;
+}
+
+// open song by extension
+static int song_playlist_open(const char *filename) {
+  const char *extension = PathFindExtension(filename);
+
+  if (_stricmp(extension, ".lyt") == 0)
+    return song_open_lyt_file(filename);
+
+  if (_stricmp(extension, ".mid") == 0 || _stricmp(extension, ".midi") == 0)
+    return song_open_midi_file(filename);
+
+  return song_open_file(filename);
+}
+
+// get song following current one, song lock must be held
+static bool song_playlist_following(uint *index) {
+  if (song_playlist_index + 1 < song_playlist.size()) {
+    *index = song_playlist_index + 1;
+    return true;
+  }
+
+  if (song_playlist_repeat && !song_playlist.empty()) {
+    *index = 0;
+    return true;
+  }
+
+  return false;
+}
+
+// decode a song saved in blocks into next tracks
+static bool song_playlist_preload(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+
+  song_settings_clear(song_next_settings);
+
+  try {
+    char magic[sizeof("FreePianoSong")];
+    char instrument[256];
+
+    read(magic, sizeof("FreePianoSong"), fp);
+    if (memcmp(magic, "FreePianoSong", sizeof("FreePianoSong")) != 0)
+      throw -1;
+
+    read(&song_next_info.version, sizeof(song_next_info.version), fp);
+    if (song_next_info.version < 0x010a0000 || song_next_info.version > current_version)
+      throw -1;
+
+    read_string(song_next_info.title, sizeof(song_next_info.title), fp);
+    read_string(song_next_info.author, sizeof(song_next_info.author), fp);
+    read_string(song_next_info.comment, sizeof(song_next_info.comment), fp);
+    read_string(instrument, sizeof(instrument), fp);
+
+    song_next_track_count = 1;
+    if (song_next_info.version >= 0x010b0000) {
+      read(&song_next_track_count, sizeof(song_next_track_count), fp);
+      if (song_next_track_count < 1 || song_next_track_count > SONG_TRACK_MAX)
+        throw -1;
+    }
+
+    for (uint i = 1; i < song_next_track_count; i++)
+      load_event_blocks(fp, song_next_tracks[i].events, song_next_settings);
+
+    load_event_blocks(fp, song_next_tracks[0].events, song_next_settings);
+
+    for (uint i = song_next_track_count; i < SONG_TRACK_MAX; i++)
+      event_store_free(song_next_tracks[i].events);
+
+    song_next_info.write_protected = true;
+    song_next_info.compatibility = true;
+
+    fclose(fp);
+    return true;
+  } catch (int) {
+    fclose(fp);
+    return false;
+  }
+}
+
+// background loader of current song has finished, without waiting
+static bool song_loader_finished() {
+  return song_loader_thread == NULL || WaitForSingleObject(song_loader_thread, 0) == WAIT_OBJECT_0;
+}
+
+// switch to the prepared song, called by the audio thread, song lock must be held
+static bool song_playlist_swap() {
+  if (!song_playlist_running || song_recording || song_next_state != SONG_NEXT_READY)
+    return false;
+
+  // loader still writes current tracks, let the worker switch after stop
+  if (!song_loader_finished())
+    return false;
+
+  // loop state is released by the song worker
+  song_loop_clear();
+
+  song_snapshots_valid = false;
+  song_snapshots_pending = true;
+  song_snapshots.swap(song_next_stale_snapshots);
+  song_worker_signal();
+
+  for (uint i = 0; i < SONG_TRACK_MAX; i++)
+    event_store_swap(song_tracks[i].events, song_next_tracks[i].events);
+
+  song_settings_t *settings = song_settings;
+  song_settings = song_next_settings;
+  song_next_settings = settings;
+
+  song_track_count = song_next_track_count;
+  song_info = song_next_info;
+  song_playlist_index = song_next_index;
+  song_auto_pedal_timer = 0;
+  play_position_seek(NULL);
+
+  // the new song starts from a clean setting like a new playback, its setting
+  // snapshots were prepared by the worker while it was preloaded
+  config_install_prepared(song_next_config);
+
+  // worker releases what was replaced and preloads the song after this one
+  InterlockedExchange(&song_next_state, SONG_NEXT_INSTALLED);
+  SetEvent(song_playlist_wake);
+  return true;
+}
+
+// release what the last swap replaced, song lock must be held
+static void song_playlist_release() {
+  for (auto it = song_next_stale_snapshots.begin(); it != song_next_stale_snapshots.end(); ++it)
+    song_snapshot_free(*it);
+  song_next_stale_snapshots.clear();
+
+  config_free_prepared(song_next_config);
+  song_next_config = NULL;
+
+  song_settings_clear(song_next_settings);
+}
+
+// playback stopped at the end of a song, song lock must be held
+static void song_playlist_stopped() {
+  if (song_playlist_running) {
+    song_playlist_ended = true;
+    SetEvent(song_playlist_wake);
+  }
+}
+
+// playlist worker
+static DWORD __stdcall song_playlist_proc(void *param) {
+  while (song_playlist_running) {
+    if (song_next_state == SONG_NEXT_INSTALLED) {
+      thread_lock lock(song_lock);
+
+      // loader of the previous song had finished before the swap
+      song_loader_wait();
+      song_playlist_release();
+      InterlockedExchange(&song_next_state, SONG_NEXT_EMPTY);
+    }
+
+    if (song_next_state == SONG_NEXT_EMPTY) {
+      std::string filename;
+      uint index;
+      bool found;
+
+      {
+        thread_lock lock(song_lock);
+        found = song_playlist_following(&index);
+        if (found)
+          filename = song_playlist[index];
+      }
+
+      if (found) {
+        InterlockedExchange(&song_next_state, SONG_NEXT_LOADING);
+        song_next_index = index;
+
+        bool ready = song_playlist_preload(filename.c_str());
+        if (ready) {
+          song_next_config = config_prepare_clear();
+          ready = song_next_config != NULL;
+        }
+
+        InterlockedExchange(&song_next_state, ready ? SONG_NEXT_READY : SONG_NEXT_FAILED);
+      }
+    }
+
+    WaitForSingleObject(song_playlist_wake, 100);
+
+    if (!song_playlist_ended)
+      continue;
+
+    // the song ended before the next one was ready
+    thread_lock lock(song_lock);
+    song_playlist_ended = false;
+
+    if (!song_playlist_running || song_playing)
+      continue;
+
+    if (song_next_state == SONG_NEXT_READY) {
+      song_loader_wait();
+      song_playlist_swap();
+      song_timer = 0;
+      song_tick = 0;
+      song_clock = 0;
+      song_playing = true;
+      song_update(0, 0);
+    } else {
+      uint index;
+      if (!song_playlist_following(&index)) {
+        song_playlist_running = false;
+        break;
+      }
+
+      song_playlist_index = index;
+      if (song_playlist_open(song_playlist[index].c_str()) == 0)
+        song_start_playback();
+
+      song_playlist_release();
+      InterlockedExchange(&song_next_state, SONG_NEXT_EMPTY);
+    }
+  }
+
+  return 0;
+}
+
+// stop playlist worker, must be called without song lock
+void song_playlist_stop() {
+  song_playlist_running = false;
+
+  if (song_playlist_thread) {
+    SetEvent(song_playlist_wake);
+    WaitForSingleObject(song_playlist_thread, INFINITE);
+    CloseHandle(song_playlist_thread);
+    song_playlist_thread = NULL;
+  }
+
+  song_playlist_ended = false;
+
+  thread_lock lock(song_lock);
+  song_playlist_release();
+  song_next_state = SONG_NEXT_EMPTY;
+}
+
+// clear playlist
+void song_playlist_clear() {
+  song_playlist_stop();
+
+  thread_lock lock(song_lock);
+  song_playlist.clear();
+  song_playlist_index = 0;
+}
+
+// add song to playlist
+void song_playlist_add(const char *filename) {
+  thread_lock lock(song_lock);
+  song_playlist.push_back(filename);
+}
+
+// start over at the end of playlist
+void song_playlist_set_repeat(bool repeat) {
+  thread_lock lock(song_lock);
+  song_playlist_repeat = repeat;
+}
+
+// play playlist from the first song
+int song_playlist_play() {
+  song_playlist_stop();
+
+  thread_lock lock(song_lock);
+
+  if (song_playlist.empty())
+    return -1;
+
+  song_playlist_index = 0;
+
+  int result = song_playlist_open(song_playlist[0].c_str());
+  if (result)
+    return result;
+
+  if (song_playlist_wake == NULL)
+    song_playlist_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  song_playlist_running = true;
+  song_playlist_thread = CreateThread(NULL, 0, &song_playlist_proc, NULL, NULL, NULL);
+
+  if (song_playlist_thread == NULL)
+    song_playlist_running = false;
+
+  song_start_playback();
+  return 0;
+}
+
+// open song, a playing playlist is stopped
+int song_open(const char *filename) {
+  song_playlist_stop();
+  return song_open_file(filename);
+}
+
+// open lyt, a playing playlist is stopped
+int song_open_lyt(const char *filename) {
+  song_playlist_stop();
+  return song_open_lyt_file(filename);
+}
+
+// open midi file, a playing playlist is stopped
+int song_open_midi(const char *filename) {
+  song_playlist_stop();
+  return song_open_midi_file(filename);
+}
+
+// close song, a playing playlist is stopped
+void song_close() {
+  song_playlist_stop();
+  song_close_file();
 }
\ No newline at end of file
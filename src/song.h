@@ -5,6 +5,7 @@
 #define SMS_KEY_MAP               0x01
 #define SMS_KEY_LABEL             0x02
 #define SMS_KEY_COLOR             0x03
+#define SMS_SETTINGS              0x04
 
 // FreePiano 1.0 messages
 #define SM_SYSTEM                 0x00
@@ -83,6 +84,16 @@
 #define SONG_SYNC_FLAG_KEYDOWN    0x10
 
 
+// offline transform of recorded events
+struct song_transform_t {
+  int grid;                 // quantize grid (ms), 0 keeps note times
+  int strength;             // percent of the distance to the grid a note moves
+  int humanize;             // random note time offset (ms)
+  int humanize_velocity;    // random velocity offset
+  double velocity_curve;    // velocity exponent, 1 keeps velocities
+  int thin;                 // min interval between controller events of a stream (ms)
+};
+
 struct song_info_t {
   uint version;
   char title[256];
@@ -95,6 +106,18 @@ struct song_info_t {
 // send event message
 void song_send_event(byte a, byte b, byte c, byte d, bool record = false);
 
+// queue event from input device, processed by next update without waiting for song lock
+void song_queue_event(byte a, byte b, byte c, byte d);
+
+// get queued input events
+uint song_get_input_queue_depth();
+
+// get times input queue was full
+uint song_get_input_queue_overflow();
+
+// get recorded events dropped because no spare chunk was left
+uint song_get_record_overflow();
+
 // output event
 void song_output_event(byte a, byte b, byte c, byte d);
 
@@ -104,6 +127,12 @@ void song_start_record();
 // stop record
 void song_stop_record();
 
+// play song and record input into a new track
+void song_start_overdub();
+
+// allow overdub
+bool song_allow_overdub();
+
 // is recoding
 bool song_is_recording();
 
@@ -113,6 +142,15 @@ void song_start_playback();
 // stop playback
 void song_stop_playback();
 
+// seek to time and play from there
+void song_seek(int time);
+
+// loop playback between start and end (ms), an empty region clears the loop
+void song_set_loop(int start, int end);
+
+// get loop region, returns false when no loop is set
+bool song_get_loop(int *start, int *end);
+
 // is recoding
 bool song_is_playing();
 
@@ -125,8 +163,11 @@ bool song_allow_input();
 // song is empty
 bool song_is_empty();
 
-// update
-void song_update(double time_elapsed);
+// update, called before rendering each audio block
+void song_update(uint samples, uint samplerate);
+
+// get sample offset of current event in audio block
+uint song_get_event_offset();
 
 // get record length
 int song_get_length();
@@ -146,15 +187,43 @@ void song_set_play_speed(double speed);
 // open lyt
 int song_open_lyt(const char *filename);
 
+// open midi file
+int song_open_midi(const char *filename);
+
 // close
 void song_close();
 
 // save song
 int song_save(const char *filename);
 
+// save song as standard midi file
+int song_save_midi(const char *filename);
+
+// quantize, humanize, map velocities and thin controllers of all tracks
+int song_transform(const song_transform_t &transform);
+
+// playlist, each song is prepared in background and follows the previous one without a gap
+void song_playlist_clear();
+void song_playlist_add(const char *filename);
+void song_playlist_set_repeat(bool repeat);
+int song_playlist_play();
+void song_playlist_stop();
+
+// recover unsaved recording from journal
+int song_recover();
+
+// start background work of songs
+int song_init();
+
+// close song and finish journal before exit
+void song_shutdown();
+
 // open song
 int song_open(const char *filename);
 
+// get load progress in percent, songs are loaded in background
+int song_get_load_progress();
+
 // get song info
 song_info_t* song_get_info();
 
@@ -19,8 +19,11 @@ static HMODULE module = NULL;
 // effect editor window
 static HWND editor_window = NULL;
 
-// midi event buffer
-static VstMidiEvent midi_event_buffer[256];
+// midi event buffer, events beyond one block are passed with the next block
+static VstMidiEvent midi_event_buffer[4096];
+
+// max events passed to the plugin per block
+#define VSTI_BLOCK_EVENTS 256
 
 // midi event count
 static uint midi_event_count = 0;
@@ -344,7 +347,7 @@ void vsti_unload_plugin() {
 
 
 // send midi event to
-void vsti_send_midi_event(byte data1, byte data2, byte data3, byte data4) {
+void vsti_send_midi_event(byte data1, byte data2, byte data3, byte data4, uint delta) {
   thread_lock lock(vsti_thread_lock);
 
   if (midi_event_count < ARRAY_COUNT(midi_event_buffer)) {
@@ -352,7 +355,7 @@ void vsti_send_midi_event(byte data1, byte data2, byte data3, byte data4) {
 
     e.type = kVstMidiType;
     e.byteSize = sizeof(VstMidiEvent);
-    e.deltaFrames = 0;
+    e.deltaFrames = delta;
     e.flags = kVstMidiEventIsRealtime;
     e.noteLength = 0;
     e.noteOffset = 0;
@@ -407,21 +410,39 @@ void vsti_process(float *left, float *right, uint buffer_size) {
   if (effect && effect_processing) {
     // process events
     struct MoreEvents : VstEvents {
-      VstEvent *data[256];
+      VstEvent *data[VSTI_BLOCK_EVENTS];
     }
     buffer;
 
-    buffer.numEvents = midi_event_count;
+    uint count = midi_event_count < VSTI_BLOCK_EVENTS ? midi_event_count : VSTI_BLOCK_EVENTS;
+
+    buffer.numEvents = count;
     buffer.reserved = 0;
 
-    for (uint i = 0; i < midi_event_count; i++)
-      buffer.events[i] = (VstEvent *)&midi_event_buffer[i];
+    for (uint i = 0; i < count; i++) {
+      VstMidiEvent *e = &midi_event_buffer[i];
+
+      if (e->deltaFrames >= (int)buffer_size)
+        e->deltaFrames = buffer_size ? buffer_size - 1 : 0;
+
+      // keep events sorted by offset, live input and playback may interleave
+      uint j = i;
+      while (j > 0 && buffer.events[j - 1]->deltaFrames > e->deltaFrames) {
+        buffer.events[j] = buffer.events[j - 1];
+        j--;
+      }
+      buffer.events[j] = (VstEvent *)e;
+    }
 
     // process events
     effect->dispatcher(effect, effProcessEvents, 0, 0, &buffer, 0);
 
-    // clear processed events
-    midi_event_count = 0;
+    // keep the rest for the next block, they are already late
+    midi_event_count -= count;
+    memmove(midi_event_buffer, midi_event_buffer + count, midi_event_count * sizeof(VstMidiEvent));
+
+    for (uint i = 0; i < midi_event_count; i++)
+      midi_event_buffer[i].deltaFrames = 0;
 
     // clear data
     memset(left, 0, buffer_size * sizeof(float));
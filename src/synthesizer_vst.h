@@ -16,8 +16,8 @@ void vsti_show_editor(bool show);
 // is editor visible
 bool vsti_is_show_editor();
 
-// send midi event
-void vsti_send_midi_event(byte a, byte b, byte c, byte d);
+// send midi event, delta is sample offset in next processed block
+void vsti_send_midi_event(byte a, byte b, byte c, byte d, uint delta = 0);
 
 // stop output
 void vsti_stop_process();